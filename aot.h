@@ -0,0 +1,49 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include <stddef.h>
+#include <algorithm>
+
+#include "tensorflow/lite/kernels/cpu_backend_context.h"
+#include "tensorflow/lite/kernels/internal/types.h"
+
+// ahead-of-time compiled model, as generated by tfaot.py: one straight-line
+// invoke() over a caller supplied arena laid out by a static plan, so any
+// number of instances can run concurrently
+typedef struct {
+	const char *source;		// .tflite file it was generated from
+	int inw, inh, inc;		// 1 x H x W x C input
+	int outw, outh, outc;	// 1 x H x W x C output
+	size_t arena;			// activation & scratch floats per instance
+	size_t inoff, outoff;	// input/output tensor offsets in the arena
+	const float *weights;	// constant data, folded at generation time
+	size_t wbytes;
+	int ops;
+	bool (*invoke)(float *arena, tflite::CpuBackendContext *ctx);
+} aotmodel_t;
+
+// NULL terminated, defined by the generated translation unit
+extern const aotmodel_t *aot_models[];
+
+#define AOT_SHAPE(d) ::tflite::RuntimeShape(sizeof(d)/sizeof(d[0]), d)
+
+// small elementwise kernels for ops without a float optimized_ops entry
+static inline void aot_clamp(const float *in, float *out, int n, float lo, float hi) {
+	for (int i = 0; i < n; i++)
+		out[i] = std::min(std::max(in[i], lo), hi);
+}
+
+static inline void aot_hardswish(const float *in, float *out, int n) {
+	for (int i = 0; i < n; i++)
+		out[i] = in[i] * std::min(std::max(in[i] + 3.0f, 0.0f), 6.0f) * (1.0f / 6.0f);
+}
+
+// x[pixels][channels] * s[channels], the squeeze & excite rescale
+static inline void aot_mul_channels(const float *x, const float *s, float *out,
+	int pixels, int channels, float lo, float hi) {
+	for (int p = 0; p < pixels; p++, x += channels, out += channels)
+		for (int c = 0; c < channels; c++)
+			out[c] = std::min(std::max(x[c] * s[c], lo), hi);
+}
+
+#endif // _AOT_H_
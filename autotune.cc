@@ -0,0 +1,245 @@
+// Startup autotuner: benchmark candidate model/thread configurations on a
+// short replay clip, pick the fastest that meets the latency & quality
+// targets, and cache the answer on disk keyed by CPU model & resolution.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "autotune.h"
+#include "segment.h"
+
+#define TUNE_FRAMES 24	// frames read from clip
+#define TUNE_WARMUP 4	// untimed frames per candidate
+
+static std::string cpu_model() {
+	std::string model = "unknown";
+	FILE *fp = fopen("/proc/cpuinfo", "r");
+	if (!fp)
+		return model;
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "model name", 10)==0) {
+			char *val = strchr(line, ':');
+			if (val) {
+				val += strspn(val, ": \t");
+				val[strcspn(val, "\n")] = 0;
+				model = val;
+			}
+			break;
+		}
+	}
+	fclose(fp);
+	return model;
+}
+
+static std::string cache_path(bool create) {
+	std::string dir;
+	if (getenv("XDG_CACHE_HOME"))
+		dir = getenv("XDG_CACHE_HOME");
+	else if (getenv("HOME"))
+		dir = std::string(getenv("HOME")) + "/.cache";
+	else
+		return "";
+	if (create) mkdir(dir.c_str(), 0755);
+	dir += "/deepseg";
+	if (create) mkdir(dir.c_str(), 0755);
+	return dir + "/autotune";
+}
+
+// cache lines: <cpu model>\t<w>x<h>/<ncpu>\t<fps>\t<reference model>\t<candidate,..>\t<model>\t<tf>\t<cv>\t<ms>\t<iou>
+// (models as absolute paths)
+static bool cache_load(const std::string& key, tuneinfo_t *ptune) {
+	FILE *fp = fopen(cache_path(false).c_str(), "r");
+	if (!fp)
+		return false;
+	bool found = false;
+	char line[4096], model[512];
+	while (!found && fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, key.c_str(), key.size())!=0 || line[key.size()]!='\t')
+			continue;
+		if (sscanf(line+key.size()+1, "%511[^\t]\t%d\t%d\t%f\t%f", model,
+			&ptune->tfthreads, &ptune->cvthreads, &ptune->ms, &ptune->iou)==5) {
+			ptune->model = model;
+			found = true;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+
+static void cache_save(const std::string& key, const tuneinfo_t *ptune) {
+	std::string path = cache_path(true);
+	// rewrite cache, replacing any previous entry for this key
+	std::vector<std::string> keep;
+	FILE *fp = fopen(path.c_str(), "r");
+	if (fp) {
+		char line[4096];
+		while (fgets(line, sizeof(line), fp)) {
+			if (strncmp(line, key.c_str(), key.size())!=0 || line[key.size()]!='\t')
+				keep.push_back(line);
+		}
+		fclose(fp);
+	}
+	fp = fopen(path.c_str(), "w");
+	if (!fp) {
+		fprintf(stderr, "Warning: could not write autotune cache: %s\n", path.c_str());
+		return;
+	}
+	for (size_t i=0; i<keep.size(); i++)
+		fputs(keep[i].c_str(), fp);
+	fprintf(fp, "%s\t%s\t%d\t%d\t%.2f\t%.3f\n", key.c_str(), ptune->model.c_str(),
+		ptune->tfthreads, ptune->cvthreads, ptune->ms, ptune->iou);
+	fclose(fp);
+}
+
+// run one configuration across all frames, returning mean time per frame (ms)
+static bool tune_run(const char *model, int tf, int cvt, std::vector<cv::Mat>& frames,
+	std::vector<cv::Mat>& masks, int w, int h, float *ms) {
+	cv::setNumThreads(cvt);
+	seginfo_t *pseg = seg_init(model, false, w, h, tf, 0);
+	if (!pseg)
+		return false;
+	masks.resize(frames.size());
+	int64 t = 0;
+	for (size_t f=0; f<frames.size()+TUNE_WARMUP; f++) {
+		size_t n = f<TUNE_WARMUP ? f%frames.size() : f-TUNE_WARMUP;
+		cv::Mat cap = frames[n].clone();
+		cv::Mat mask = cv::Mat::zeros(h,w,CV_32FC1);
+		int64 t0 = cv::getTickCount();
+		bool ok = seg_prepare(pseg, cap) && seg_infer(pseg) && seg_mask(pseg, mask);
+		if (!ok) {
+			seg_stop(pseg);
+			return false;
+		}
+		if (f>=TUNE_WARMUP) {
+			t += cv::getTickCount()-t0;
+			masks[n] = mask;
+		}
+	}
+	seg_stop(pseg);
+	*ms = (float)(t*1000.0/cv::getTickFrequency()/frames.size());
+	return true;
+}
+
+// absolute model path for cache keys, as given if it can't be resolved
+static std::string model_path(const char *model) {
+	char *path = realpath(model, NULL);
+	if (!path)
+		return model;
+	std::string abs = path;
+	free(path);
+	return abs;
+}
+
+// intersection over union of thresholded masks across all frames
+static float mask_iou(std::vector<cv::Mat>& a, std::vector<cv::Mat>& b) {
+	int64 in = 0, un = 0;
+	for (size_t f=0; f<a.size(); f++) {
+		const float *pa = (const float *)a[f].data;
+		const float *pb = (const float *)b[f].data;
+		for (size_t p=0; p<a[f].total(); p++) {
+			bool fa = pa[p]>0.5, fb = pb[p]>0.5;
+			in += (fa && fb);
+			un += (fa || fb);
+		}
+	}
+	// two empty masks agree perfectly
+	return un ? (float)in/(float)un : 1.0;
+}
+
+bool tune_config(const char *clip, const char *refmodel, const std::vector<const char *>& models,
+	int w, int h, int ncpu, float maxms, float miniou, tuneinfo_t *ptune, int debug) {
+	// the frame time is both the target and part of the cache key
+	if (!(maxms>0) || !isfinite(maxms)) {
+		fprintf(stderr, "Error: autotune needs a known frame rate\n");
+		return false;
+	}
+	char res[32], rate[32];
+	sprintf(res, "%dx%d/%d", w, h, ncpu);
+	sprintf(rate, "%.1ffps", 1000.0/maxms);
+	// a tuning only holds for the same candidates (eg. an explicit -m) and
+	// target frame rate
+	std::string key = cpu_model() + "\t" + res + "\t" + rate + "\t" + model_path(refmodel);
+	for (size_t m=0; m<models.size(); m++)
+		key += (m ? "," : "\t") + model_path(models[m]);
+	if (cache_load(key, ptune)) {
+		printf("autotune: cached %s tf=%d cv=%d (%.1fms iou=%.3f)\n", ptune->model.c_str(),
+			ptune->tfthreads, ptune->cvthreads, ptune->ms, ptune->iou);
+		return true;
+	}
+
+	// load tuning clip
+	std::vector<cv::Mat> frames;
+	cv::VideoCapture cap(clip);
+	cv::Mat frame;
+	while (frames.size()<TUNE_FRAMES && cap.read(frame)) {
+		cv::Mat sized;
+		cv::resize(frame,sized,cv::Size(w,h));
+		frames.push_back(sized);
+	}
+	if (frames.empty()) {
+		fprintf(stderr, "Warning: could not read autotune clip: %s\n", clip);
+		return false;
+	}
+	printf("autotune: %s, %d frames @ %s\n", clip, (int)frames.size(), res);
+
+	// reference masks
+	std::vector<cv::Mat> ref, masks;
+	float ms;
+	if (!tune_run(refmodel, ncpu, ncpu, frames, ref, w, h, &ms))
+		return false;
+
+	// candidate thread splits: TFLite in powers of two up to all cores,
+	// OpenCV either single threaded or taking the remaining cores
+	std::vector<std::pair<int,int> > splits;
+	std::vector<int> tfs;
+	for (int tf=1; tf<ncpu; tf*=2)
+		tfs.push_back(tf);
+	tfs.push_back(ncpu);
+	for (size_t t=0; t<tfs.size(); t++) {
+		int tf = tfs[t];
+		splits.push_back(std::make_pair(tf, 1));
+		if (ncpu-tf>1)
+			splits.push_back(std::make_pair(tf, ncpu-tf));
+	}
+
+	bool found = false, fast = false;
+	for (size_t m=0; m<models.size(); m++) {
+		for (size_t s=0; s<splits.size(); s++) {
+			if (!tune_run(models[m], splits[s].first, splits[s].second, frames, masks, w, h, &ms)) {
+				fprintf(stderr, "Warning: autotune skipping model: %s\n", models[m]);
+				break;
+			}
+			float iou = mask_iou(masks, ref);
+			if (debug) printf("autotune: %s tf=%d cv=%d %.1fms iou=%.3f\n", models[m],
+				splits[s].first, splits[s].second, ms, iou);
+			if (iou < miniou)
+				continue;
+			// prefer anything meeting the latency target, then the fastest
+			bool inbudget = ms <= maxms;
+			if (!found || (inbudget && !fast) || (inbudget==fast && ms < ptune->ms)) {
+				ptune->model = models[m];
+				ptune->tfthreads = splits[s].first;
+				ptune->cvthreads = splits[s].second;
+				ptune->ms = ms;
+				ptune->iou = iou;
+				found = true;
+				fast = inbudget;
+			}
+		}
+	}
+	if (!found)
+		return false;
+	if (!fast)
+		fprintf(stderr, "Warning: autotune found nothing within %.1fms, using fastest\n", maxms);
+	printf("autotune: selected %s tf=%d cv=%d (%.1fms iou=%.3f)\n", ptune->model.c_str(),
+		ptune->tfthreads, ptune->cvthreads, ptune->ms, ptune->iou);
+	cache_save(key, ptune);
+	return true;
+}
@@ -0,0 +1,22 @@
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <string>
+#include <vector>
+
+// tuned configuration
+typedef struct {
+	std::string model;
+	int tfthreads;		// TFLite interpreter threads
+	int cvthreads;		// OpenCV parallel_for threads
+	float ms;			// mean per-frame segmentation time
+	float iou;			// mask agreement with reference model
+} tuneinfo_t;
+
+// find the fastest (model, TFLite threads, OpenCV threads) within ncpu,
+// meeting maxms and miniou (vs. refmodel) on clip, cached per CPU model,
+// CPU budget & resolution
+bool tune_config(const char *clip, const char *refmodel, const std::vector<const char *>& models,
+	int w, int h, int ncpu, float maxms, float miniou, tuneinfo_t *ptune, int debug);
+
+#endif // _AUTOTUNE_H_
@@ -0,0 +1,320 @@
+// Multi-stream scalability benchmark: runs N simulated camera streams through
+// full deepseg pipelines (capture, segment, composite, I420 sink), sweeping N
+// upwards until the service level objective breaks, and prints a capacity
+// curve (CSV) per model and thread configuration.
+
+#include <unistd.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+#include "capture.h"
+#include "segment.h"
+#include "blend.h"
+#include "dispatch.h"
+
+#define BENCH_CHECK(x)                                       \
+  if (!(x)) {                                                \
+	fprintf(stderr, "Error at %s:%d\n", __FILE__, __LINE__); \
+	exit(1);                                                 \
+  }
+
+// crash dumper
+void trap(int sig) {
+#define MAXOOPS 20
+	void *oops[MAXOOPS];
+	fprintf(stderr, "SIGNAL:%d\n", sig);
+	int n=backtrace(oops, MAXOOPS);
+	backtrace_symbols_fd(oops, n, 2);
+	exit(1);
+}
+
+// per-stream state & results
+typedef struct {
+	const char *source;
+	const char *model;
+	bool usehog;
+	int w, h;
+	int threads;
+	int debug;
+	volatile bool ready;	// pipeline initialised
+	volatile bool measure;	// record results
+	volatile bool done;		// stop stream
+	int rate;
+	int64 frames;
+	std::vector<float> lat;	// per-frame capture to output latency (ms)
+	pthread_t tid;
+} stream_t;
+
+static double now_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+
+static double cpu_s() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec/1e6 +
+		(double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec/1e6;
+}
+
+// inference only: time seg_infer() on a prepared frame, to compare model
+// backends (e.g. aot:<model> against the interpreter) without the pipeline
+static void bench_infer(const char *model, bool usehog, int w, int h, int threads, int iters, int debug) {
+	seginfo_t *pseg = seg_init(model, usehog, w, h, threads, debug);
+	BENCH_CHECK(pseg!=NULL);
+	cv::Mat cap = cv::Mat(h,w,CV_8UC3,cv::Scalar(96,128,160));
+	BENCH_CHECK(seg_prepare(pseg, cap));
+	for (int i=0; i<10; i++)	// warm up
+		BENCH_CHECK(seg_infer(pseg));
+
+	std::vector<float> lat;
+	double c0 = cpu_s(), t0 = now_s();
+	for (int i=0; i<iters; i++) {
+		int64 e0 = cv::getTickCount();
+		BENCH_CHECK(seg_infer(pseg));
+		lat.push_back((float)((cv::getTickCount()-e0)*1000.0/cv::getTickFrequency()));
+	}
+	double el = now_s()-t0;
+	std::sort(lat.begin(), lat.end());
+	printf("%s,%d,%d,%.2f,%.2f,%.2f,%.0f\n", model, threads, iters, el*1000.0/iters,
+		lat[lat.size()/2], lat[(size_t)(0.99*(lat.size()-1))], (cpu_s()-c0)/el*100.0);
+	fflush(stdout);
+	seg_stop(pseg);
+}
+
+// one complete pipeline, as per deepseg main loop + render callback
+static void *stream_thread(void *arg) {
+	stream_t *ps = (stream_t *)arg;
+	int capw = ps->w, caph = ps->h;
+	capinfo_t *pcap = capture_init(ps->source, &capw, &caph, &ps->rate, ps->debug);
+	BENCH_CHECK(pcap!=NULL);
+	seginfo_t *pseg = seg_init(ps->model, ps->usehog, ps->w, ps->h, ps->threads, ps->debug);
+	BENCH_CHECK(pseg!=NULL);
+	cv::Mat bg = cv::Mat(ps->h,ps->w,CV_8UC3,cv::Scalar(0,255,0));
+	cv::Mat mask = cv::Mat::zeros(ps->h,ps->w,CV_32FC1);
+	cv::Mat out, yuv;
+	ps->ready = true;
+
+	int64 lcap = 0;
+	while (!ps->done) {
+		// wait for next capture frame
+		while (lcap==capture_count(pcap) && !ps->done) {
+			struct timespec ts = { 0, 1000000 }; // 1ms
+			clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+		}
+		lcap = capture_count(pcap);
+
+		cv::Mat cap;
+		int64 seq, ts;
+		capture_frame(pcap, cap, &seq, &ts);
+		if (cap.cols != ps->w || cap.rows != ps->h)
+			cv::resize(cap,cap,cv::Size(ps->w,ps->h));
+		BENCH_CHECK(seg_prepare(pseg, cap));
+		BENCH_CHECK(seg_infer(pseg));
+		BENCH_CHECK(seg_mask(pseg, mask));
+		blend_frame(cap, bg, mask, out);
+		cv::cvtColor(out,yuv,CV_BGR2YUV_I420);
+		if (ps->measure) {
+			// capture to output, including time waiting for pickup
+			ps->lat.push_back((float)((cv::getTickCount()-ts)*1000.0/cv::getTickFrequency()));
+			ps->frames++;
+		}
+	}
+	capture_stop(pcap);
+	seg_stop(pseg);
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+
+	printf("deepseg-bench v0.2.1\n");
+
+	signal(SIGSEGV, trap);
+	signal(SIGABRT, trap);
+	int debug   = 0;
+	int width   = 640;
+	int height  = 480;
+	int maxn    = 16;
+	int period  = 10;
+	int iters   = 0;
+	float fpsr  = 0.9;
+	float p99l  = 100.0;
+	bool usehog = false;
+	const char *source = "images/orac.mp4";
+	std::vector<const char *> models;
+	std::vector<int> threadl;
+
+	bool showUsage = false;
+	for (int arg=1; arg<argc; arg++) {
+		bool hasArgument = arg+1 < argc;
+		if (strncmp(argv[arg], "-?", 2)==0) {
+			showUsage = true;
+		} else if (strncmp(argv[arg], "-d", 2)==0) {
+			++debug;
+		} else if (strncmp(argv[arg], "-g", 2)==0) {
+			usehog = true;
+		} else if (strncmp(argv[arg], "-s", 2)==0) {
+			if (hasArgument) {
+				source = argv[++arg];
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "-m", 2)==0) {
+			if (hasArgument) {
+				models.push_back(argv[++arg]);
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "-t", 2)==0) {
+			int threads = 0;
+			if (hasArgument && sscanf(argv[++arg], "%d", &threads) && threads>0) {
+				threadl.push_back(threads);
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "-w", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%d", &width) || !width)
+				showUsage = true;
+		} else if (strncmp(argv[arg], "-h", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%d", &height) || !height)
+				showUsage = true;
+		} else if (strncmp(argv[arg], "-n", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%d", &maxn) || maxn<1)
+				showUsage = true;
+		} else if (strncmp(argv[arg], "-i", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%d", &iters) || iters<1)
+				showUsage = true;
+		} else if (strncmp(argv[arg], "-T", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%d", &period) || period<1)
+				showUsage = true;
+		} else if (strncmp(argv[arg], "-f", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%f", &fpsr))
+				showUsage = true;
+		} else if (strncmp(argv[arg], "-l", 2)==0) {
+			if (!hasArgument || !sscanf(argv[++arg], "%f", &p99l))
+				showUsage = true;
+		}
+	}
+
+	if (showUsage) {
+		fprintf(stderr, "\n");
+		fprintf(stderr, "usage:\n");
+		fprintf(stderr, "  deepseg-bench [-?] [-d] [-s <source>] [-m <model>].. [-t <threads>].. [-g]\n");
+		fprintf(stderr, "    [-w <width>] [-h <height>] [-n <streams>] [-T <seconds>] [-f <ratio>] [-l <ms>]\n");
+		fprintf(stderr, "    [-i <iterations>]\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "-?            Display this usage information\n");
+		fprintf(stderr, "-d            Increase debug level\n");
+		fprintf(stderr, "-s            Specify the stream source (video file, device or synthetic[:<fps>])\n");
+		fprintf(stderr, "-m            Add a TFLite model to benchmark (repeatable)\n");
+		fprintf(stderr, "-t            Add a per-stream thread count to benchmark (repeatable)\n");
+		fprintf(stderr, "-g            Use dlib's hoG facial detector, ignores Tensorflow model\n");
+		fprintf(stderr, "-w            Specify the video stream width\n");
+		fprintf(stderr, "-h            Specify the video stream height\n");
+		fprintf(stderr, "-n            Specify the maximum number of concurrent streams\n");
+		fprintf(stderr, "-T            Specify the measurement period per step (seconds)\n");
+		fprintf(stderr, "-f            SLO: minimum per-stream fps as a fraction of source rate\n");
+		fprintf(stderr, "-l            SLO: maximum p99 frame latency (ms)\n");
+		fprintf(stderr, "-i            Inference only: time <iterations> invocations per model and thread count\n");
+		exit(1);
+	}
+	if (models.empty())
+		models.push_back("models/segm_full_v679.tflite");
+	if (threadl.empty())
+		threadl.push_back(2);
+
+	printf("source: %s\n", source);
+	printf("width:  %d\n", width);
+	printf("height: %d\n", height);
+	printf("usehog: %d\n", usehog);
+	printf("maxn:   %d\n", maxn);
+	printf("cpu:    %s kernels\n", cpu_name(cpu_level()));
+	if (iters) {
+		printf("iters:  %d\n\n", iters);
+		printf("model,threads,iters,mean_ms,p50_ms,p99_ms,cpu_pct\n");
+		for (size_t m=0; m<models.size(); m++)
+			for (size_t t=0; t<threadl.size(); t++)
+				bench_infer(models[m], usehog, width, height, threadl[t], iters, debug);
+		return 0;
+	}
+	printf("period: %ds\n", period);
+	printf("slo:    fps>=%.2f*rate p99<=%.1fms\n\n", fpsr, p99l);
+
+	// CSV capacity curve, one line per (model, threads, streams) step
+	printf("model,threads,streams,rate,fps_min,fps_avg,p99_ms,cpu_pct,slo\n");
+	for (size_t m=0; m<models.size(); m++) {
+		for (size_t t=0; t<threadl.size(); t++) {
+			for (int n=1; n<=maxn; n++) {
+				// start N streams and wait for them to initialise
+				std::vector<stream_t> streams(n);
+				for (int s=0; s<n; s++) {
+					stream_t *ps = &streams[s];
+					ps->source = source;
+					ps->model = models[m];
+					ps->usehog = usehog;
+					ps->w = width;
+					ps->h = height;
+					ps->threads = threadl[t];
+					ps->debug = debug;
+					ps->ready = ps->measure = ps->done = false;
+					ps->rate = 0;
+					ps->frames = 0;
+					BENCH_CHECK(pthread_create(&ps->tid, NULL, stream_thread, ps)==0);
+				}
+				for (int s=0; s<n; s++) {
+					while (!streams[s].ready) {
+						struct timespec ts = { 0, 10000000 }; // 10ms
+						clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+					}
+				}
+				// settle for a second, then measure
+				sleep(1);
+				double c0 = cpu_s(), t0 = now_s();
+				for (int s=0; s<n; s++)
+					streams[s].measure = true;
+				sleep(period);
+				for (int s=0; s<n; s++)
+					streams[s].measure = false;
+				double c1 = cpu_s(), t1 = now_s();
+				for (int s=0; s<n; s++)
+					streams[s].done = true;
+				for (int s=0; s<n; s++)
+					pthread_join(streams[s].tid, NULL);
+
+				// gather results
+				double el = t1-t0;
+				float fmin = 1e9, fsum = 0;
+				std::vector<float> lat;
+				for (int s=0; s<n; s++) {
+					float fps = (float)(streams[s].frames/el);
+					if (debug) fprintf(stderr, "stream %d: %ld frames %3.1ffps\n", s, streams[s].frames, fps);
+					fmin = std::min(fmin, fps);
+					fsum += fps;
+					lat.insert(lat.end(), streams[s].lat.begin(), streams[s].lat.end());
+				}
+				float p99 = 0;
+				if (!lat.empty()) {
+					std::sort(lat.begin(), lat.end());
+					p99 = lat[(size_t)(0.99*(lat.size()-1))];
+				}
+				float cpu = (float)((c1-c0)/el/n*100.0);
+				int rate = streams[0].rate;
+				bool slo = (fmin >= fpsr*rate) && (p99 <= p99l);
+				printf("%s,%d,%d,%d,%.1f,%.1f,%.1f,%.0f,%s\n", models[m], threadl[t], n, rate,
+					fmin, fsum/n, p99, cpu, slo ? "ok" : "broken");
+				fflush(stdout);
+				if (!slo)
+					break;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+// Mask driven compositing of capture over background
+#include <stdint.h>
+
+#include <opencv2/core.hpp>
+
+#include "blend.h"
+#include "dispatch.h"
+
+// per-row kernels, compiled for each ISA level (see dispatch.h): blend n
+// pixels, writing them in order or mirrored (horizontal flip)
+static CPU_KERNEL void blend_row(const uint8_t *rptr, const uint8_t *bptr, const float *aptr, uint8_t *optr, int n) {
+	for (int pix=0; pix<n; ++pix) {
+		// blending weights
+		float rw=aptr[pix], bw=1.0f-rw;
+		// blend each channel byte
+		for (int c=0; c<3; ++c)
+			optr[pix*3+c] = (uint8_t)( (float)rptr[pix*3+c]*rw + (float)bptr[pix*3+c]*bw );
+	}
+}
+CPU_VARIANTS(void, blend_row, (const uint8_t *rptr, const uint8_t *bptr, const float *aptr, uint8_t *optr, int n),
+	(rptr, bptr, aptr, optr, n))
+
+static CPU_KERNEL void blend_row_mirror(const uint8_t *rptr, const uint8_t *bptr, const float *aptr, uint8_t *optr, int n) {
+	for (int pix=0; pix<n; ++pix) {
+		float rw=aptr[pix], bw=1.0f-rw;
+		for (int c=0; c<3; ++c)
+			optr[(n-1-pix)*3+c] = (uint8_t)( (float)rptr[pix*3+c]*rw + (float)bptr[pix*3+c]*bw );
+	}
+}
+CPU_VARIANTS(void, blend_row_mirror, (const uint8_t *rptr, const uint8_t *bptr, const float *aptr, uint8_t *optr, int n),
+	(rptr, bptr, aptr, optr, n))
+
+typedef void (*rowfn_t)(const uint8_t *, const uint8_t *, const float *, uint8_t *, int);
+
+// blend a band of rows, run on OpenCV's thread pool so compositing shares
+// the same thread budget as OpenCV's own functions. FLIP is resolved at
+// compile time: flipped output rows/pixels are written in mirrored order.
+template<int FLIP> class BlendRows : public cv::ParallelLoopBody {
+	const cv::Mat& cap;
+	const cv::Mat& bg;
+	const cv::Mat& mask;
+	cv::Mat& out;
+	rowfn_t row;
+public:
+	BlendRows(const cv::Mat& c, const cv::Mat& b, const cv::Mat& m, cv::Mat& o) :
+		cap(c), bg(b), mask(m), out(o),
+		row((FLIP & BLEND_FLIP_HORZ) ? CPU_SELECT(blend_row_mirror) : CPU_SELECT(blend_row)) {}
+	virtual void operator()(const cv::Range& rows) const {
+		for (int r=rows.start; r<rows.end; ++r) {
+			int orow = (FLIP & BLEND_FLIP_VERT) ? cap.rows-1-r : r;
+			row(cap.ptr<uint8_t>(r), bg.ptr<uint8_t>(r), mask.ptr<float>(r), out.ptr<uint8_t>(orow), cap.cols);
+		}
+	}
+};
+
+template<int FLIP> static void blend_flip(const cv::Mat& cap, const cv::Mat& bg, const cv::Mat& mask, cv::Mat& out) {
+	// alpha blend cap and background images using mask, adapted from:
+	// https://www.learnopencv.com/alpha-blending-using-opencv-cpp-python/
+	out.create(cap.rows, cap.cols, cap.type());
+	if (FLIP & BLEND_SERIAL)
+		BlendRows<FLIP>(cap, bg, mask, out)(cv::Range(0, cap.rows));
+	else
+		cv::parallel_for_(cv::Range(0, cap.rows), BlendRows<FLIP>(cap, bg, mask, out));
+}
+
+void blend_frame(const cv::Mat& cap, const cv::Mat& bg, const cv::Mat& mask, cv::Mat& out) {
+	blend_flip<0>(cap, bg, mask, out);
+}
+
+blendfn_t blend_select(int flip) {
+	static const blendfn_t fns[8] = {
+		blend_flip<0>,
+		blend_flip<BLEND_FLIP_VERT>,
+		blend_flip<BLEND_FLIP_HORZ>,
+		blend_flip<BLEND_FLIP_VERT|BLEND_FLIP_HORZ>,
+		blend_flip<BLEND_SERIAL>,
+		blend_flip<BLEND_SERIAL|BLEND_FLIP_VERT>,
+		blend_flip<BLEND_SERIAL|BLEND_FLIP_HORZ>,
+		blend_flip<BLEND_SERIAL|BLEND_FLIP_VERT|BLEND_FLIP_HORZ>,
+	};
+	return fns[flip & 7];
+}
+
+const char *blend_name(int flip) {
+	static const char *names[8] = { "blend", "blend+vflip", "blend+hflip", "blend+rotate",
+		"blend/serial", "blend+vflip/serial", "blend+hflip/serial", "blend+rotate/serial" };
+	return names[flip & 7];
+}
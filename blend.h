@@ -0,0 +1,21 @@
+#ifndef _BLEND_H_
+#define _BLEND_H_
+
+#include <opencv2/core/mat.hpp>
+
+// output orientation, applied while blending (no extra flip passes)
+#define BLEND_FLIP_VERT	0x01
+#define BLEND_FLIP_HORZ	0x02
+// blend on the calling thread rather than OpenCV's pool, whose workers
+// carry the scheduling policy of the thread that created them
+#define BLEND_SERIAL	0x04
+
+// alpha blend BGR24 cap over BGR24 bg using CV_32FC1 mask (1.0 => cap)
+typedef void (*blendfn_t)(const cv::Mat& cap, const cv::Mat& bg, const cv::Mat& mask, cv::Mat& out);
+void blend_frame(const cv::Mat& cap, const cv::Mat& bg, const cv::Mat& mask, cv::Mat& out);
+
+// select the blend specialised for flip (BLEND_* flags) once at startup
+blendfn_t blend_select(int flip);
+const char *blend_name(int flip);
+
+#endif // _BLEND_H_
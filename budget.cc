@@ -0,0 +1,61 @@
+// Thread budget: size TFLite, OpenCV and pipeline threads from one CPU count
+// so they don't oversubscribe the machine.
+//
+// The inference thread runs preprocessing (OpenCV), Invoke (TFLite) and
+// postprocessing (OpenCV) in sequence, and both libraries use the calling
+// thread as a worker, so TFLite and OpenCV share the CPUs left over after
+// the render & decode threads rather than splitting them. deepseg's own data
+// parallel loops run on OpenCV's pool (cv::parallel_for_), leaving exactly
+// two pools; TFLite's (ruy/eigen) cannot be replaced from outside.
+#include <stdio.h>
+
+#include <opencv2/core.hpp>
+
+#include "budget.h"
+#include "cgroup.h"
+
+int budget_cpus() {
+	// honours taskset/cpuset restrictions and container CPU quotas,
+	// unlike _SC_NPROCESSORS_ONLN
+	cginfo_t cg;
+	cgroup_read(&cg);
+	return cg.cpus;
+}
+
+// requested threads (0 for all) capped to the CPUs left for inference
+static int budget_fit(const char *what, int want, int infer) {
+	if (want<0)
+		fprintf(stderr, "Warning: invalid %s threads %d, using %d\n", what, want, infer);
+	else if (want>infer)
+		fprintf(stderr, "Warning: %d %s threads exceed the budget, using %d\n", want, what, infer);
+	else if (want>0)
+		return want;
+	return infer;
+}
+
+void budget_init(budget_t *pbud, int total, bool bkgvideo, int tflite, int opencv, int debug) {
+	pbud->total = total>0 ? total : budget_cpus();
+	pbud->render = 1;
+	pbud->decode = bkgvideo ? 1 : 0;
+	int infer = pbud->total - pbud->render - pbud->decode;
+	if (infer<1)
+		infer = 1;
+	pbud->tflite = budget_fit("TFLite", tflite, infer);
+	pbud->opencv = budget_fit("OpenCV", opencv, infer);
+	if (debug) printf("budget: total=%d render=%d decode=%d tflite=%d opencv=%d\n",
+		pbud->total, pbud->render, pbud->decode, pbud->tflite, pbud->opencv);
+}
+
+// no-op loop body, just to get OpenCV's pool threads started
+class PoolStart : public cv::ParallelLoopBody {
+public:
+	virtual void operator()(const cv::Range&) const {}
+};
+
+void budget_apply(const budget_t *pbud) {
+	cv::setNumThreads(pbud->opencv);
+	// start the pool now, so its workers inherit the calling thread's
+	// scheduling policy & affinity rather than those of whichever thread
+	// happens to call into OpenCV first
+	cv::parallel_for_(cv::Range(0, pbud->opencv), PoolStart());
+}
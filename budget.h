@@ -0,0 +1,17 @@
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+// one CPU budget shared by deepseg's own threads, TFLite and OpenCV
+typedef struct {
+	int total;		// CPUs available to deepseg
+	int render;		// capture/render thread
+	int decode;		// background video decode thread
+	int tflite;		// interpreter threads (inference thread + workers)
+	int opencv;		// OpenCV parallel_for pool (also runs deepseg's kernels)
+} budget_t;
+
+int budget_cpus();
+void budget_init(budget_t *pbud, int total, bool bkgvideo, int tflite, int opencv, int debug);
+void budget_apply(const budget_t *pbud);
+
+#endif // _BUDGET_H_
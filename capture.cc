@@ -1,39 +1,72 @@
 // OpenCV video capture thread wrapper
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <math.h>
 
 #include <opencv2/videoio.hpp>
+#include <opencv2/imgproc.hpp>
 #include <opencv2/videoio/videoio_c.h>	// for various macro values
 
 #include "capture.h"
+#include "schedpol.h"
 
 // threaded capture state
 struct _capinfo_t {
-	cv::VideoCapture *cap;
+	cv::VideoCapture *cap;	// NULL for synthetic source
 	cv::Mat *grab;
 	int64 cnt;
+	int64 seq;		// frame sequence number (never reset)
+	int64 ts;		// grab time of current frame (cv::getTickCount)
 	pthread_mutex_t lock;
 	pthread_t tid;
 	struct timespec last;
 	int w, h, rate;
 	bool (*callback)(cv::Mat *, void *);
 	void *cb_ctx;
+	int64 synth;
 };
 
+// synthetic source: drifting gradient with a swaying head & shoulders blob,
+// enough for benchmarking without a camera (model cost is content independent)
+static bool synth_frame(capinfo_t *ci, cv::Mat& out) {
+	out.create(ci->h, ci->w, CV_8UC3);
+	int shift = (int)(ci->synth % 256);
+	for (int y=0; y<ci->h; y++) {
+		uint8_t *p = out.ptr<uint8_t>(y);
+		uint8_t gy = (uint8_t)(y*255/ci->h);
+		for (int x=0; x<ci->w; x++) {
+			uint8_t gx = (uint8_t)((x*255/ci->w + shift) & 0xff);
+			*p++ = gx; *p++ = gy; *p++ = 255-gx;
+		}
+	}
+	double t = (double)ci->synth/(double)ci->rate;
+	int cx = ci->w/2 + (int)(sin(t)*ci->w/6);
+	cv::ellipse(out, cv::Point(cx, ci->h), cv::Size(ci->w/4, ci->h/3), 0, 0, 360, cv::Scalar(90,60,40), cv::FILLED);
+	cv::ellipse(out, cv::Point(cx, ci->h/2), cv::Size(ci->w/10, ci->h/6), 0, 0, 360, cv::Scalar(140,170,220), cv::FILLED);
+	ci->synth++;
+	return true;
+}
+
 // capture thread function
 static void *grab_thread(void *arg) {
 	capinfo_t *ci = (capinfo_t *)arg;
 	bool done = false;
 	// while we have a grab frame.. grab frames
 	while (!done) {
-		bool ok = ci->cap->grab();
+		bool ok = (ci->cap!=NULL) ? ci->cap->grab() : true;
+		int64 ts = cv::getTickCount();
 		pthread_mutex_lock(&ci->lock);
 		ci->cnt++;
 		if (ci->grab!=NULL) {
 			if (ok)
-				ok = ci->cap->retrieve(*(ci->grab));
+				ok = (ci->cap!=NULL) ? ci->cap->retrieve(*(ci->grab)) : synth_frame(ci, *(ci->grab));
+			if (ok) {
+				ci->seq++;
+				ci->ts = ts;
+			}
 			if (ok && ci->callback!=NULL)
 				ok = ci->callback(ci->grab, ci->cb_ctx);
 		} else {
@@ -42,7 +75,8 @@ static void *grab_thread(void *arg) {
 		pthread_mutex_unlock(&ci->lock);
 		// if we had grab, retrieve or callback failure, try looping
 		if (!ok) {
-			ci->cap->set(CV_CAP_PROP_POS_FRAMES, 0);
+			if (ci->cap!=NULL)
+				ci->cap->set(CV_CAP_PROP_POS_FRAMES, 0);
 			ci->cnt = 0;
 		}
 		// ensure we wait until next expected frame
@@ -59,12 +93,32 @@ static void *grab_thread(void *arg) {
 capinfo_t *capture_init(const char *device, int *w, int *h, int *r, int debug) {
 	// allocate capture info and contents
 	capinfo_t *pcap = new capinfo_t;
-	pcap->cap = new cv::VideoCapture;
+	pcap->cap = NULL;
 	pcap->grab = new cv::Mat;
 	pcap->cnt = 0;
-	pcap->lock = PTHREAD_MUTEX_INITIALIZER;
+	pcap->seq = 0;
+	pcap->ts = 0;
+	schedpol_mutex_init(&pcap->lock);
 	pcap->callback = NULL;
 	pcap->cb_ctx = NULL;
+	pcap->synth = 0;
+	// synthetic source ("synthetic[:<fps>]"), generated at requested size
+	if (strncmp(device, "synthetic", 9)==0) {
+		pcap->w = *w;
+		pcap->h = *h;
+		pcap->rate = 30;
+		if (device[9]==':')
+			sscanf(device+10, "%d", &pcap->rate);
+		if (pcap->rate<=0)
+			pcap->rate = 30;
+		*r = pcap->rate;
+		clock_gettime(CLOCK_MONOTONIC, &pcap->last);
+		if (pthread_create(&pcap->tid, NULL, grab_thread, pcap)) {
+			return NULL;
+		}
+		return pcap;
+	}
+	pcap->cap = new cv::VideoCapture;
 	// check for local device name and ensure using V4L2, set capture props,
 	// otherwise assume URL and allow OpenCV to choose the right backend,
 	// finally, always enable RGB (actually BGR24) conversion so we have sane input
@@ -82,8 +136,10 @@ capinfo_t *capture_init(const char *device, int *w, int *h, int *r, int debug) {
 	pcap->w=*w=(int)pcap->cap->get(CV_CAP_PROP_FRAME_WIDTH);
 	pcap->h=*h=(int)pcap->cap->get(CV_CAP_PROP_FRAME_HEIGHT);
 	pcap->rate=*r=(int)pcap->cap->get(CV_CAP_PROP_FPS);
-	if (pcap->rate<0)
-		pcap->rate=*r=30;	// default V4L2 rate (says OpenCV manual)
+	// unknown (or a fractional rate truncated to 0): default V4L2 rate
+	// (says OpenCV manual), everything downstream divides by it
+	if (pcap->rate<=0)
+		pcap->rate=*r=30;
 	clock_gettime(CLOCK_MONOTONIC, &pcap->last);
 	// kick off separate grabber thread to keep OpenCV/FFMpeg happy (or it lags badly)
 	if (pthread_create(&pcap->tid, NULL, grab_thread, pcap)) {
@@ -92,7 +148,7 @@ capinfo_t *capture_init(const char *device, int *w, int *h, int *r, int debug) {
 	return pcap;
 }
 
-void capture_frame(capinfo_t *pcap, cv::Mat& out) {
+void capture_frame(capinfo_t *pcap, cv::Mat& out, int64 *seq, int64 *ts) {
 	// done?
 	if (!pcap->grab)
 		return;
@@ -104,6 +160,8 @@ void capture_frame(capinfo_t *pcap, cv::Mat& out) {
 	// copy buffer out under lock
 	pthread_mutex_lock(&pcap->lock);
 	pcap->grab->copyTo(out);
+	if (seq) *seq = pcap->seq;
+	if (ts) *ts = pcap->ts;
 	pthread_mutex_unlock(&pcap->lock);
 	return;
 }
@@ -112,6 +170,10 @@ int64 capture_count(capinfo_t *pcap) {
 	return pcap->cnt;
 }
 
+int64 capture_seq(capinfo_t *pcap) {
+	return pcap->seq;
+}
+
 void capture_setcb(capinfo_t *pcap, bool (*cb)(cv::Mat *, void *), void *ctx) {
 	pthread_mutex_lock(&pcap->lock);
 	pcap->callback = cb;
@@ -119,6 +181,10 @@ void capture_setcb(capinfo_t *pcap, bool (*cb)(cv::Mat *, void *), void *ctx) {
 	pthread_mutex_unlock(&pcap->lock);
 }
 
+pthread_t capture_tid(capinfo_t *pcap) {
+	return pcap->tid;
+}
+
 void capture_stop(capinfo_t *pcap) {
 	pthread_mutex_lock(&pcap->lock);
 	pcap->grab = NULL;
@@ -1,6 +1,7 @@
 #ifndef _CAPTURE_H_
 #define _CAPTURE_H_
 
+#include <pthread.h>
 #include <opencv2/core/mat.hpp>
 
 // opaque type for callers
@@ -8,9 +9,11 @@ struct _capinfo_t;
 typedef struct _capinfo_t capinfo_t;
 
 capinfo_t *capture_init(const char* device, int *w, int *h, int *r, int debug);
-void capture_frame(capinfo_t *pcap, cv::Mat& out);
+void capture_frame(capinfo_t *pcap, cv::Mat& out, int64 *seq=NULL, int64 *ts=NULL);
 int64 capture_count(capinfo_t *pcap);
+int64 capture_seq(capinfo_t *pcap);
 void capture_setcb(capinfo_t *pcap, bool (*cb)(cv::Mat *, void *), void *ctx);
+pthread_t capture_tid(capinfo_t *pcap);
 void capture_stop(capinfo_t *pcap);
 
 #endif // _CAPTURE_H_
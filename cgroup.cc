@@ -0,0 +1,167 @@
+// Container awareness: read CPU quota, cpuset and throttling statistics
+// from the cgroup (v2 unified or v1 cpu controller) we are running in.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "cgroup.h"
+
+#define CGROOT "/sys/fs/cgroup"
+
+// our cgroup path for the named v1 controller, or v2 (ctrl==NULL)
+static bool cgroup_path(const char *ctrl, std::string& path) {
+	FILE *fp = fopen("/proc/self/cgroup", "r");
+	if (!fp)
+		return false;
+	char line[512];
+	bool found = false;
+	while (!found && fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = 0;
+		// <id>:<controllers>:<path>
+		char *ctl = strchr(line, ':');
+		char *grp = ctl ? strchr(ctl+1, ':') : NULL;
+		if (!grp)
+			continue;
+		*grp++ = 0;
+		++ctl;
+		if (ctrl==NULL) {
+			found = (strcmp(line, "0")==0 && *ctl==0);
+		} else {
+			// comma separated controller list, eg: cpu,cpuacct
+			for (char *tok = strtok(ctl, ","); tok && !found; tok = strtok(NULL, ","))
+				found = (strcmp(tok, ctrl)==0);
+		}
+		if (found)
+			path = grp;
+	}
+	fclose(fp);
+	return found;
+}
+
+// step p up to its parent cgroup, false if already at the root
+static bool cgroup_parent(std::string& p) {
+	if (p.empty() || p=="/")
+		return false;
+	size_t slash = p.rfind('/');
+	p = (slash==std::string::npos) ? "" : p.substr(0, slash);
+	return true;
+}
+
+// first readable file of name in dir or its ancestors (containers usually
+// see their own cgroup mounted at the root, hosts the full path)
+static FILE *cgroup_open(const std::string& dir, const std::string& sub, const char *name) {
+	std::string p = sub;
+	do {
+		FILE *fp = fopen((dir + p + "/" + name).c_str(), "r");
+		if (fp)
+			return fp;
+	} while (cgroup_parent(p));
+	return NULL;
+}
+
+// quota in CPUs set on one cgroup directory, 0 if none
+static double cgroup_limit(const std::string& d, bool v2) {
+	FILE *fp;
+	double quota = 0;
+	if (v2) {
+		// "<quota|max> <period>"
+		if ((fp = fopen((d + "/cpu.max").c_str(), "r"))==NULL)
+			return 0;
+		char q[32];
+		long long period;
+		if (fscanf(fp, "%31s %lld", q, &period)==2 && strcmp(q, "max")!=0 && period>0)
+			quota = (double)atoll(q)/(double)period;
+		fclose(fp);
+	} else {
+		// cpu.cfs_quota_us (-1 => unlimited) / cpu.cfs_period_us
+		long long q = -1, period = 0;
+		if ((fp = fopen((d + "/cpu.cfs_quota_us").c_str(), "r"))==NULL)
+			return 0;
+		if (fscanf(fp, "%lld", &q)!=1)
+			q = -1;
+		fclose(fp);
+		if ((fp = fopen((d + "/cpu.cfs_period_us").c_str(), "r"))!=NULL) {
+			if (fscanf(fp, "%lld", &period)!=1)
+				period = 0;
+			fclose(fp);
+		}
+		if (q>0 && period>0)
+			quota = (double)q/(double)period;
+	}
+	return quota > 0 ? quota : 0;
+}
+
+// effective quota: the smallest one set on our cgroup or any ancestor
+// (a parent's limit applies to all of its children), 0 if unlimited
+static double cgroup_quota(const std::string& dir, const std::string& sub, bool v2) {
+	double min = 0;
+	std::string p = sub;
+	do {
+		double q = cgroup_limit(dir + p, v2);
+		if (q>0 && (min==0 || q<min))
+			min = q;
+	} while (cgroup_parent(p));
+	return min;
+}
+
+static void cgroup_stat(FILE *fp, cginfo_t *pcg, bool v2) {
+	char key[64];
+	long long val;
+	while (fscanf(fp, "%63s %lld", key, &val)==2) {
+		if (strcmp(key, "nr_throttled")==0)
+			pcg->nr_throttled = val;
+		else if (v2 && strcmp(key, "throttled_usec")==0)
+			pcg->throttled_us = val;
+		else if (!v2 && strcmp(key, "throttled_time")==0)
+			pcg->throttled_us = val/1000;	// v1 reports ns
+	}
+	fclose(fp);
+}
+
+bool cgroup_read(cginfo_t *pcg) {
+	pcg->quota = 0;
+	pcg->nr_throttled = 0;
+	pcg->throttled_us = 0;
+	// cpuset restrictions show up in our affinity mask
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set)==0)
+		pcg->cpuset = CPU_COUNT(&set);
+	else
+		pcg->cpuset = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	std::string sub;
+	FILE *fp;
+	bool found = false;
+	if (cgroup_path(NULL, sub) && (fp = cgroup_open(CGROOT, sub, "cpu.max"))!=NULL) {
+		// v2
+		fclose(fp);
+		pcg->quota = cgroup_quota(CGROOT, sub, true);
+		if ((fp = cgroup_open(CGROOT, sub, "cpu.stat"))!=NULL)
+			cgroup_stat(fp, pcg, true);
+		found = true;
+	} else if (cgroup_path("cpu", sub)) {
+		// v1, the cpu controller's mount point varies
+		const char *dirs[] = { CGROOT "/cpu,cpuacct", CGROOT "/cpu", CGROOT "/cpuacct,cpu" };
+		for (size_t d=0; d<sizeof(dirs)/sizeof(dirs[0]) && !found; d++) {
+			if ((fp = cgroup_open(dirs[d], sub, "cpu.cfs_quota_us"))==NULL)
+				continue;
+			fclose(fp);
+			pcg->quota = cgroup_quota(dirs[d], sub, false);
+			if ((fp = cgroup_open(dirs[d], sub, "cpu.stat"))!=NULL)
+				cgroup_stat(fp, pcg, false);
+			found = true;
+		}
+	}
+
+	pcg->cpus = pcg->cpuset;
+	if (pcg->quota>0 && (int)ceil(pcg->quota) < pcg->cpus)
+		pcg->cpus = (int)ceil(pcg->quota);
+	if (pcg->cpus<1)
+		pcg->cpus = 1;
+	return found;
+}
@@ -0,0 +1,17 @@
+#ifndef _CGROUP_H_
+#define _CGROUP_H_
+
+#include <stdint.h>
+
+// CPU limits & throttling from cgroup v1/v2 (and cpuset via affinity)
+typedef struct {
+	int cpus;				// usable CPUs: cpuset, capped by quota (rounded up)
+	int cpuset;				// CPUs in affinity mask/cpuset
+	double quota;			// quota/period in CPUs (tightest ancestor), 0 if unlimited
+	int64_t nr_throttled;	// periods throttled
+	int64_t throttled_us;	// total time throttled
+} cginfo_t;
+
+bool cgroup_read(cginfo_t *pcg);
+
+#endif // _CGROUP_H_
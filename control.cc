@@ -0,0 +1,151 @@
+// Unix domain socket control interface: a thread accepting local clients
+// and passing each command line to the owner's handler
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "control.h"
+
+#define CTL_LINE 1024
+
+struct _ctlinfo_t {
+	int fd;			// listening socket
+	volatile int cfd;	// connected client, or -1
+	std::string path;
+	ctlfn_t fn;
+	void *ctx;
+	pthread_t tid;
+	volatile bool done;
+	int debug;
+};
+
+static void control_client(ctlinfo_t *pctl, int cfd) {
+	char line[CTL_LINE];
+	size_t len = 0;
+	while (!pctl->done) {
+		ssize_t n = read(cfd, line+len, sizeof(line)-1-len);
+		if (n <= 0)
+			break;
+		len += n;
+		line[len] = 0;
+		// handle each complete line
+		char *eol;
+		while ((eol = strchr(line, '\n')) != NULL) {
+			*eol = 0;
+			if (eol>line && eol[-1]=='\r')
+				eol[-1] = 0;
+			char *cmd = line + strspn(line, " \t");
+			char *arg = cmd + strcspn(cmd, " \t");
+			if (*arg) {
+				*arg++ = 0;
+				arg += strspn(arg, " \t");
+			}
+			if (*cmd) {
+				std::string reply;
+				bool ok = pctl->fn(cmd, arg, reply, pctl->ctx);
+				if (pctl->debug) printf("\ncontrol: %s %s => %s %s\n", cmd, arg, ok ? "ok" : "error", reply.c_str());
+				std::string out = (ok ? "ok" : "error") + (reply.empty() ? "" : " " + reply) + "\n";
+				if (write(cfd, out.c_str(), out.size()) < 0)
+					return;
+			}
+			len -= (eol+1-line);
+			memmove(line, eol+1, len+1);
+		}
+		if (len == sizeof(line)-1) {
+			// overlong line, discard
+			const char *err = "error line too long\n";
+			if (write(cfd, err, strlen(err)) < 0)
+				return;
+			len = 0;
+		}
+	}
+}
+
+static void *control_thread(void *arg) {
+	ctlinfo_t *pctl = (ctlinfo_t *)arg;
+	while (!pctl->done) {
+		int cfd = accept(pctl->fd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno==EINTR)
+				continue;
+			break;
+		}
+		pctl->cfd = cfd;
+		control_client(pctl, cfd);
+		pctl->cfd = -1;
+		close(cfd);
+	}
+	return NULL;
+}
+
+ctlinfo_t *control_init(const char *path, ctlfn_t fn, void *ctx, int debug) {
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: control socket path too long: %s\n", path);
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("control socket");
+		return NULL;
+	}
+	// replace a stale socket left by a previous run, but nothing else
+	struct stat st;
+	if (lstat(path, &st)==0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "Error: control socket path exists and is not a socket: %s\n", path);
+			close(fd);
+			return NULL;
+		}
+		unlink(path);
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("control socket bind");
+		close(fd);
+		return NULL;
+	}
+	// owner only, set before listen() so no one can connect in between
+	if (chmod(path, 0600) < 0 || listen(fd, 4) < 0) {
+		perror("control socket listen");
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	ctlinfo_t *pctl = new ctlinfo_t;
+	pctl->fd = fd;
+	pctl->cfd = -1;
+	pctl->path = path;
+	pctl->fn = fn;
+	pctl->ctx = ctx;
+	pctl->done = false;
+	pctl->debug = debug;
+	if (pthread_create(&pctl->tid, NULL, control_thread, pctl)) {
+		perror("control thread");
+		close(fd);
+		unlink(path);
+		delete pctl;
+		return NULL;
+	}
+	return pctl;
+}
+
+void control_stop(ctlinfo_t *pctl) {
+	pctl->done = true;
+	// wake accept() and any blocked client read
+	shutdown(pctl->fd, SHUT_RDWR);
+	int cfd = pctl->cfd;
+	if (cfd >= 0)
+		shutdown(cfd, SHUT_RDWR);
+	close(pctl->fd);
+	unlink(pctl->path.c_str());
+	pthread_join(pctl->tid, NULL);
+	delete pctl;
+}
@@ -0,0 +1,18 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <string>
+
+// opaque type for callers
+struct _ctlinfo_t;
+typedef struct _ctlinfo_t ctlinfo_t;
+
+// command handler: called on the control thread for each "<cmd> [<arg>]"
+// line received, returns success and fills reply (sent as "ok|error <reply>")
+typedef bool (*ctlfn_t)(const char *cmd, const char *arg, std::string& reply, void *ctx);
+
+// line based Unix domain socket control interface, one client at a time
+ctlinfo_t *control_init(const char *path, ctlfn_t fn, void *ctx, int debug);
+void control_stop(ctlinfo_t *pctl);
+
+#endif // _CONTROL_H_
@@ -0,0 +1,62 @@
+// Latest-frame-wins deadline scheduler: frames that can no longer make
+// their deadline are dropped before the expensive stages, in favour of the
+// newest captured frame, so mask latency stays bounded under load.
+#include <stdio.h>
+#include <math.h>
+
+#include "deadline.h"
+
+#define DEADLINE_DEFAULT_MS	(2000.0/30)	// two frames at a typical 30fps
+
+void deadline_init(deadline_t *pdl, double budget_ms) {
+	// an unusable budget would silently never drop anything
+	if (!(budget_ms>0) || !isfinite(budget_ms)) {
+		fprintf(stderr, "Warning: invalid frame deadline, using %.0fms\n", DEADLINE_DEFAULT_MS);
+		budget_ms = DEADLINE_DEFAULT_MS;
+	}
+	pdl->budget = (int64)(budget_ms*cv::getTickFrequency()/1000.0);
+	pdl->est = 0;
+	pdl->mark = 0;
+	pdl->lseq = 0;
+	pdl->frames = 0;
+	pdl->dropped = 0;
+	pdl->late = 0;
+}
+
+// new frame picked up: count any we never saw, drop it if already too late
+bool deadline_start(deadline_t *pdl, int64 seq, int64 ts) {
+	if (pdl->lseq && seq > pdl->lseq+1)
+		pdl->dropped += seq-pdl->lseq-1;
+	pdl->lseq = seq;
+	if (cv::getTickCount() > ts+pdl->budget) {
+		++pdl->dropped;
+		return false;
+	}
+	return true;
+}
+
+// frame deliberately not processed (reduced inference rate), not a drop
+void deadline_skip(deadline_t *pdl, int64 seq) {
+	pdl->lseq = seq;
+}
+
+// about to infer: abandon this frame if it cannot finish in time and a
+// newer one is waiting (which stands a better chance)
+bool deadline_infer(deadline_t *pdl, int64 ts, bool newer) {
+	pdl->mark = cv::getTickCount();
+	if (newer && pdl->mark+pdl->est > ts+pdl->budget) {
+		++pdl->dropped;
+		return false;
+	}
+	return true;
+}
+
+// mask published: update the estimate, count lateness
+void deadline_done(deadline_t *pdl, int64 ts) {
+	int64 now = cv::getTickCount();
+	int64 took = now-pdl->mark;
+	pdl->est = pdl->est ? (pdl->est*7+took)/8 : took;
+	++pdl->frames;
+	if (now > ts+pdl->budget)
+		++pdl->late;
+}
@@ -0,0 +1,24 @@
+#ifndef _DEADLINE_H_
+#define _DEADLINE_H_
+
+#include <opencv2/core.hpp>
+
+// latest-frame-wins deadline scheduling for the inference loop: each frame
+// must have its mask published within budget of being captured
+typedef struct {
+	int64 budget;		// ticks allowed from capture to mask publish
+	int64 est;			// estimated infer+mask time (EWMA, ticks)
+	int64 mark;			// start of infer for current frame
+	int64 lseq;			// last frame sequence seen
+	int64 frames;		// masks published
+	int64 dropped;		// frames skipped or abandoned
+	int64 late;			// masks published after their deadline
+} deadline_t;
+
+void deadline_init(deadline_t *pdl, double budget_ms);
+bool deadline_start(deadline_t *pdl, int64 seq, int64 ts);
+void deadline_skip(deadline_t *pdl, int64 seq);
+bool deadline_infer(deadline_t *pdl, int64 ts, bool newer);
+void deadline_done(deadline_t *pdl, int64 ts);
+
+#endif // _DEADLINE_H_
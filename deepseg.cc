@@ -15,14 +15,28 @@ limitations under the License.
 #include <unistd.h>
 #include <signal.h>
 #include <execinfo.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include <cstdio>
 
 #include <opencv2/opencv.hpp>
 
 #include "loopback.h"
 #include "capture.h"
-#include "inference.h"
-#include "dlibhog.h"
+#include "segment.h"
+#include "blend.h"
+#include "dispatch.h"
+#include "autotune.h"
+#include "budget.h"
+#include "cgroup.h"
+#include "schedpol.h"
+#include "deadline.h"
+#include "degrade.h"
+#include "control.h"
+#include "residency.h"
+#include "memstat.h"
+#include "procbg.h"
 
 
 #define TFLITE_MINIMAL_CHECK(x)                              \
@@ -41,33 +55,73 @@ void trap(int sig) {
 	exit(1);
 }
 
-// deeplabv3 classes
-std::vector<std::string> labels = { "background", "aeroplane", "bicycle", "bird", "boat", "bottle", "bus", "car", "cat", "chair", "cow", "dining table", "dog", "horse", "motorbike", "person", "potted plant", "sheep", "sofa", "train", "tv" };
+// frame-synchronous mode: delay line of captured frames, and recent masks
+// with the sequence number of the frame each was computed from (fewer of
+// each with --max-memory)
+#define SYNC_FRAMES 8
+#define SYNC_MASKS  4
+#define SMALL_FRAMES 4
 
 typedef struct {
 	capinfo_t *pcap;
 	capinfo_t *pbkg;
+	procinfo_t *pgen;	// procedural background, rendered per frame
+	cv::Mat bgimg;		// static background as loaded
+	std::vector<uchar> bgfile;	// or still encoded (compact), if not empty
 	cv::Mat bg;
-	cv::Mat mask;
+	cv::Mat mask[SYNC_MASKS];
+	int64 mseq[SYNC_MASKS];
+	int nmasks;			// mask slots in use
+	int mlast;			// most recently published mask
+	bool sync;			// blend delayed frames with their own masks
+	int delay;			// delay line length (frames)
+	cv::Mat frames[SYNC_FRAMES];
+	int64 fseq[SYNC_FRAMES];
+	int nframes;		// delay line slots in use
+	bool compact;		// keep static backgrounds encoded
 	int lbfd;
-	int outw, outh;
-	int flip;
+	int lbw, lbh;		// virtual camera format (fixed once open)
+	int outw, outh;		// processing size
+	blendfn_t blend;	// composite stage, specialised for flip
 	int debug;
 	bool done;
+	int64 start;		// process start, for time to first frame
+	bool shown;			// first camera frame written
 	pthread_mutex_t lock;
 } frame_ctx_t;
-#define FLIP_VERT   0x01
-#define FLIP_HORZ   0x02
+
+// write a BGR frame to v4l2loopback as YUV420p
+static bool loopback_write(int fd, cv::Mat& out) {
+	cv::Mat yuv;
+	cv::cvtColor(out,yuv,CV_BGR2YUV_I420);
+	int framesize = yuv.step[0]*yuv.rows;
+	while (framesize > 0) {
+		int ret = write(fd,yuv.data,framesize);
+		if (ret <= 0)
+			return false;
+		framesize -= ret;
+	}
+	return true;
+}
+
+static double ms_since(int64 t) {
+	return (cv::getTickCount()-t)*1000.0/cv::getTickFrequency();
+}
 
 // Process an incoming raw video frame
 bool process_frame(cv::Mat *cap, void *ctx) {
 	frame_ctx_t *pfr = (frame_ctx_t *)ctx;
+	cv::Mat out;
+	cv::Mat *src = cap;
+	pthread_mutex_lock(&pfr->lock);     // (lock to protect access to mask.data, background & size)
 	// grab next available background frame (if video)
 	if (pfr->pbkg!=NULL) {
 		capture_frame(pfr->pbkg, pfr->bg);
 		// resize to output if required
 		if (pfr->bg.cols != pfr->outw || pfr->bg.rows != pfr->outh)
 			cv::resize(pfr->bg,pfr->bg,cv::Size(pfr->outw,pfr->outh));
+	} else if (pfr->pgen!=NULL) {
+		procbg_frame(pfr->pgen, pfr->outw, pfr->outh, pfr->bg);
 	}
 	// otherwise assume pfr->bg is a suitable static image..
 
@@ -75,41 +129,37 @@ bool process_frame(cv::Mat *cap, void *ctx) {
 	if (cap->cols != pfr->outw || cap->rows != pfr->outh)
 		cv::resize(*cap,*cap,cv::Size(pfr->outw,pfr->outh));
 
-	// alpha blend cap and background images using mask, adapted from:
-	// https://www.learnopencv.com/alpha-blending-using-opencv-cpp-python/
-	cv::Mat out = cv::Mat::zeros(cap->size(), cap->type());
-	uint8_t *optr = (uint8_t*)out.data;
-	pthread_mutex_lock(&pfr->lock);     // (lock to protect access to mask.data)
-	uint8_t *rptr = (uint8_t*)cap->data;
-	uint8_t *bptr = (uint8_t*)pfr->bg.data;
-	float   *aptr = (float*)pfr->mask.data;
-	int npix = cap->rows * cap->cols;
-	for (int pix=0; pix<npix; ++pix) {
-		// blending weights
-		float rw=*aptr, bw=1.0-rw;
-		// blend each channel byte
-		*optr = (uint8_t)( (float)(*rptr)*rw + (float)(*bptr)*bw ); ++rptr; ++bptr; ++optr;
-		*optr = (uint8_t)( (float)(*rptr)*rw + (float)(*bptr)*bw ); ++rptr; ++bptr; ++optr;
-		*optr = (uint8_t)( (float)(*rptr)*rw + (float)(*bptr)*bw ); ++rptr; ++bptr; ++optr;
-		++aptr;
+	int m = pfr->mlast;
+	if (pfr->sync) {
+		// push frame into delay line, output the one from delay frames ago
+		// blended with the newest mask computed from it (or before it)
+		int64 seq = capture_seq(pfr->pcap);
+		int slot = seq % pfr->nframes;
+		cap->copyTo(pfr->frames[slot]);
+		pfr->fseq[slot] = seq;
+		int64 want = seq - pfr->delay;
+		slot = (want % pfr->nframes + pfr->nframes) % pfr->nframes;
+		if (pfr->fseq[slot] == want) {
+			src = &pfr->frames[slot];
+			for (int i=0; i<pfr->nmasks; i++) {
+				if (pfr->mseq[i] <= want && (pfr->mseq[m] > want || pfr->mseq[i] > pfr->mseq[m]))
+					m = i;
+			}
+		}
 	}
+	pfr->blend(*src, pfr->bg, pfr->mask[m], out);
 	pthread_mutex_unlock(&pfr->lock);
 
-	// flip either way?
-	if (pfr->flip & FLIP_HORZ)
-		cv::flip(out,out,1);
-	if (pfr->flip & FLIP_VERT)
-		cv::flip(out,out,0);
+	// scale to the virtual camera format if processing at another size
+	if (out.cols != pfr->lbw || out.rows != pfr->lbh)
+		cv::resize(out,out,cv::Size(pfr->lbw,pfr->lbh));
 
 	// write frame to v4l2loopback
-	cv::Mat yuv;
-	cv::cvtColor(out,yuv,CV_BGR2YUV_I420);
-	int framesize = yuv.step[0]*yuv.rows;
-	while (framesize > 0) {
-		int ret = write(pfr->lbfd,yuv.data,framesize);
-		if (ret <= 0)
-			return false;
-		framesize -= ret;
+	if (!loopback_write(pfr->lbfd, out))
+		return false;
+	if (!pfr->shown) {
+		pfr->shown = true;
+		printf("startup: first frame after %.0fms\n", ms_since(pfr->start));
 	}
 
 	char ti[64];
@@ -118,8 +168,8 @@ bool process_frame(cv::Mat *cap, void *ctx) {
 		cv::imshow(ti,*cap);
 		sprintf(ti, "bg: %dx%d/%d", pfr->bg.cols, pfr->bg.rows, pfr->bg.type());
 		cv::imshow(ti,pfr->bg);
-		sprintf(ti, "mask: %dx%d/%d", pfr->mask.cols, pfr->mask.rows, pfr->mask.type());
-		cv::imshow(ti,pfr->mask);
+		sprintf(ti, "mask: %dx%d/%d", pfr->mask[m].cols, pfr->mask[m].rows, pfr->mask[m].type());
+		cv::imshow(ti,pfr->mask[m]);
 	}
 	if (pfr->debug > 1) {
 		sprintf(ti, "out: %dx%d/%d", out.cols, out.rows, out.type());
@@ -129,31 +179,382 @@ bool process_frame(cv::Mat *cap, void *ctx) {
 	return true;
 }
 
+// check background file extension (yeah, I know) to spot videos..
+static bool background_video(const char *back) {
+	if (!back || access(back, R_OK)!=0)
+		return false;
+	char *dot = rindex((char*)back, '.');
+	return !(dot!=NULL &&
+		(strcasecmp(dot, ".png")==0 ||
+		 strcasecmp(dot, ".jpg")==0 ||
+		 strcasecmp(dot, ".jpeg")==0));
+}
+
+// fit the static background to the processing size (under lock)
+static void background_fit(frame_ctx_t *pfr) {
+	if (!pfr->bgfile.empty())
+		cv::resize(cv::imdecode(pfr->bgfile,cv::IMREAD_COLOR),pfr->bg,cv::Size(pfr->outw,pfr->outh));
+	else
+		cv::resize(pfr->bgimg,pfr->bg,cv::Size(pfr->outw,pfr->outh));
+}
+
+// compact background: the image file itself, decoded when the size changes
+static bool background_file(const char *back, std::vector<uchar>& file) {
+	FILE *fp = fopen(back, "rb");
+	if (!fp)
+		return false;
+	fseek(fp, 0, SEEK_END);
+	file.resize(ftell(fp));
+	rewind(fp);
+	bool ok = fread(file.data(), 1, file.size(), fp)==file.size();
+	fclose(fp);
+	return ok;
+}
+
+// longest wait for a background video's first frame
+#define BACKGROUND_WAIT_MS 5000
+
+// load a background image, start capture of a background video, or set up
+// a procedural one
+static bool background_open(const char *back, cv::Mat& img, capinfo_t **ppbkg, procinfo_t **ppgen, int w, int h, int debug) {
+	*ppbkg = NULL;
+	*ppgen = NULL;
+	if (procbg_spec(back)) {
+		*ppgen = procbg_init(back, debug);
+		return *ppgen!=NULL;
+	}
+	if (!back || access(back, R_OK)!=0)
+		return false;
+	if (!background_video(back)) {
+		// read background into raw BGR24 format
+		img = cv::imread(back);
+		return !img.empty();
+	}
+	// assume video background..start capture, and hand it over only once
+	// the first frame is decoded: process_frame() fetches background frames
+	// under the frame lock, where capture_frame() must not have to wait
+	int bkgw = w, bkgh = h, rate;
+	*ppbkg = capture_init(back, &bkgw, &bkgh, &rate, debug);
+	if (*ppbkg==NULL)
+		return false;
+	for (int ms=0; capture_seq(*ppbkg)==0; ms++) {
+		if (ms==BACKGROUND_WAIT_MS) {
+			fprintf(stderr, "Warning: no frame from background video after %dms\n", BACKGROUND_WAIT_MS);
+			capture_stop(*ppbkg);
+			*ppbkg = NULL;
+			return false;
+		}
+		usleep(1000);
+	}
+	return true;
+}
+
+// independent startup steps (capture device, background, model), each run
+// on its own thread so the slowest one sets the time to first mask, not
+// the sum; results are read after pthread_join()
+typedef struct {
+	const char *ccam, *back, *modelname;
+	bool usehog;
+	int w, h, threads, debug;
+	capinfo_t *pcap;	// capture step
+	int capw, caph, rate;
+	cv::Mat bgimg;		// background step
+	capinfo_t *pbkg;
+	procinfo_t *pgen;
+	bool bgok;
+	seginfo_t *pseg;	// model step
+	double tcap, tbkg, tseg;	// step times (ms)
+} startup_t;
+
+static void *start_capture(void *arg) {
+	startup_t *pst = (startup_t *)arg;
+	int64 t = cv::getTickCount();
+	pst->capw = pst->w;
+	pst->caph = pst->h;
+	pst->pcap = capture_init(pst->ccam, &pst->capw, &pst->caph, &pst->rate, pst->debug);
+	pst->tcap = ms_since(t);
+	return NULL;
+}
+
+static void *start_background(void *arg) {
+	startup_t *pst = (startup_t *)arg;
+	int64 t = cv::getTickCount();
+	pst->bgok = background_open(pst->back, pst->bgimg, &pst->pbkg, &pst->pgen, pst->w, pst->h, pst->debug);
+	if (!pst->bgok) {
+		// default background to green screen
+		if (pst->back) {
+			fprintf(stderr, "Warning: could not load background, defaulting to green\n");
+		}
+		pst->bgimg = cv::Mat(pst->h,pst->w,CV_8UC3,cv::Scalar(0,255,0));
+	}
+	pst->tbkg = ms_since(t);
+	return NULL;
+}
+
+static void *start_model(void *arg) {
+	startup_t *pst = (startup_t *)arg;
+	int64 t = cv::getTickCount();
+	pst->pseg = seg_init(pst->modelname, pst->usehog, pst->w, pst->h, pst->threads, pst->debug);
+	pst->tseg = ms_since(t);
+	return NULL;
+}
+
+static size_t mat_bytes(const cv::Mat& m) {
+	return m.total()*m.elemSize();
+}
+
+// resident memory by subsystem: TFLite, frames, masks and background are
+// the sizes held, within the anonymous memory, whose remainder is "other"
+static void memory_report(frame_ctx_t *pfr, seginfo_t *pseg, int maxmem) {
+	memstat_t ms;
+	if (!memstat_read(&ms))
+		return;
+	size_t arena, weights, frames = 0, masks = 0, back;
+	seg_memory(pseg, &arena, &weights);
+	pthread_mutex_lock(&pfr->lock);
+	for (int f=0; f<SYNC_FRAMES; f++)
+		frames += mat_bytes(pfr->frames[f]);
+	for (int m=0; m<pfr->nmasks; m++)
+		masks += mat_bytes(pfr->mask[m]);
+	back = mat_bytes(pfr->bg) + mat_bytes(pfr->bgimg) + pfr->bgfile.size();
+	pthread_mutex_unlock(&pfr->lock);
+	size_t held = arena + weights + frames + masks + back;
+	size_t other = ms.anon > held ? ms.anon-held : 0;
+#define MB(b) ((b)/(1024.0*1024.0))
+	printf("\nmemory: %.1fMB resident: tflite %.1fMB (arena %.1f, model %.1f), frames %.1fMB, masks %.1fMB, "
+		"background %.1fMB, dlib %.1fMB, code %.1fMB, other %.1fMB", MB(ms.rss),
+		MB(arena+weights+ms.model), MB(arena), MB(weights+ms.model), MB(frames), MB(masks),
+		MB(back), MB(ms.dlib), MB(ms.code), MB(other));
+	if (maxmem)
+		printf(", limit %dMB%s", maxmem, MB(ms.rss) > maxmem ? " (exceeded)" : "");
+	printf("\n");
+#undef MB
+}
+
+// supervisor (-Z): the pipeline is loaded and run once on a grey frame in
+// this process, single threaded since fork() keeps only the calling thread
+// (TFLite and OpenCV pools are created by each worker), then workers are
+// forked from the warm image, again whenever one dies or on SIGHUP
+
+// returns the warm pipeline, in each forked worker
+static seginfo_t *zygote_run(const char *modelname, bool usehog, int w, int h, int debug) {
+	int64 t = cv::getTickCount();
+	cv::setNumThreads(0);
+	seginfo_t *pseg = seg_init(modelname, usehog, w, h, 1, debug);
+	TFLITE_MINIMAL_CHECK(pseg!=NULL);
+	cv::Mat grey(h,w,CV_8UC3,cv::Scalar(128,128,128));
+	cv::Mat mask = cv::Mat::zeros(h,w,CV_32FC1);
+	TFLITE_MINIMAL_CHECK(seg_prepare(pseg, grey) && seg_infer(pseg) && seg_mask(pseg, mask));
+	printf("zygote: %s warm after %.0fms\n", seg_chain(pseg), ms_since(t));
+
+	// SIGHUP and worker exits are taken synchronously (sigwaitinfo), so a
+	// restart is only ever for a worker this supervisor terminated
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGHUP);
+	sigaddset(&sigs, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
+	for (;;) {
+		fflush(stdout);
+		int64 t0 = cv::getTickCount();
+		pid_t pid = fork();
+		TFLITE_MINIMAL_CHECK(pid>=0);
+		if (pid==0) {
+			sigprocmask(SIG_UNBLOCK, &sigs, NULL);
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			resident_fork();
+			return pseg;
+		}
+		printf("zygote: worker %d started\n", pid);
+		int status;
+		bool hup = false;
+		pid_t done;
+		while ((done = waitpid(pid, &status, WNOHANG))==0) {
+			// a SIGCHLD from an exit after the check above stays pending
+			if (sigwaitinfo(&sigs, NULL)==SIGHUP && !hup) {
+				kill(pid, SIGTERM);
+				hup = true;
+			}
+		}
+		TFLITE_MINIMAL_CHECK(done==pid);
+		if (!hup && WIFEXITED(status) && WEXITSTATUS(status)==0)
+			exit(0);
+		if (WIFSIGNALED(status))
+			printf("\nzygote: worker %d killed by signal %d, restarting\n", pid, WTERMSIG(status));
+		else
+			printf("\nzygote: worker %d exited with %d, restarting\n", pid, WEXITSTATUS(status));
+		// don't spin on a worker failing at startup (e.g. camera gone)
+		if (!hup && ms_since(t0) < 1000)
+			sleep(1);
+	}
+}
+
+// live reconfiguration over the control socket: replacement pipelines and
+// backgrounds are loaded on the control thread, then swapped in by the
+// inference loop (pipeline, threads) or under the frame lock (background),
+// so the virtual camera keeps getting frames throughout
+typedef struct {
+	pthread_mutex_t lock;
+	frame_ctx_t *pfr;
+	schedpol_t *pols;
+	std::string model;	// current model ("hog" for HOG detector)
+	std::string back;	// current background ("green" for none)
+	int w, h;			// current processing size
+	int tflite;			// current TFLite threads, for new pipelines
+	int rate;			// inference rate limit (fps, 0 => every frame)
+	seginfo_t *pseg;	// replacement pipeline, NULL if none pending
+	int pw, ph;			// its processing size
+	int threads;		// requested TFLite threads, 0 if none pending
+	int debug;
+} reconf_t;
+
+static bool control_cmd(const char *cmd, const char *arg, std::string& reply, void *ctx) {
+	reconf_t *prc = (reconf_t *)ctx;
+	char buf[256];
+	if (strcmp(cmd, "threads")==0) {
+		int threads = atoi(arg);
+		if (threads<1) {
+			reply = "usage: threads <n>";
+			return false;
+		}
+		pthread_mutex_lock(&prc->lock);
+		prc->threads = threads;
+		pthread_mutex_unlock(&prc->lock);
+	} else if (strcmp(cmd, "rate")==0) {
+		int rate = -1;
+		if (sscanf(arg, "%d", &rate)!=1 || rate<0) {
+			reply = "usage: rate <fps> (0 for every frame)";
+			return false;
+		}
+		pthread_mutex_lock(&prc->lock);
+		prc->rate = rate;
+		pthread_mutex_unlock(&prc->lock);
+	} else if (strcmp(cmd, "model")==0 || strcmp(cmd, "size")==0) {
+		pthread_mutex_lock(&prc->lock);
+		std::string model = prc->model;
+		int w = prc->w, h = prc->h, tflite = prc->tflite;
+		pthread_mutex_unlock(&prc->lock);
+		if (cmd[0]=='m') {
+			if (!*arg) {
+				reply = "usage: model <file.tflite>|hog";
+				return false;
+			}
+			model = arg;
+		} else if (sscanf(arg, "%dx%d", &w, &h)!=2 || w<2 || h<2 || (w|h)&1) {
+			reply = "usage: size <even width>x<even height>";
+			return false;
+		}
+		// build the replacement here, the inference loop only swaps it in
+		seginfo_t *pseg = seg_init(model.c_str(), model=="hog", w, h, tflite, prc->debug);
+		if (pseg==NULL) {
+			reply = "could not load " + model;
+			return false;
+		}
+		pthread_mutex_lock(&prc->lock);
+		if (prc->pseg!=NULL)
+			seg_stop(prc->pseg);	// superseded before pickup
+		prc->pseg = pseg;
+		prc->pw = prc->w = w;
+		prc->ph = prc->h = h;
+		prc->model = model;
+		pthread_mutex_unlock(&prc->lock);
+		reply = seg_chain(pseg);
+	} else if (strcmp(cmd, "background")==0) {
+		frame_ctx_t *pfr = prc->pfr;
+		cv::Mat img;
+		capinfo_t *pbkg = NULL;
+		procinfo_t *pgen = NULL;
+		// output size as of now (a size command may change it meanwhile,
+		// process_frame() scales background frames to whatever it is then)
+		pthread_mutex_lock(&pfr->lock);
+		int outw = pfr->outw, outh = pfr->outh;
+		pthread_mutex_unlock(&pfr->lock);
+		if (strcmp(arg, "green")==0) {
+			img = cv::Mat(1,1,CV_8UC3,cv::Scalar(0,255,0));
+		} else if (!background_open(arg, img, &pbkg, &pgen, outw, outh, prc->debug)) {
+			reply = std::string("could not load ") + arg;
+			return false;
+		}
+		if (pbkg!=NULL)
+			schedpol_apply(capture_tid(pbkg), &prc->pols[STAGE_BACKGROUND], "background", prc->debug);
+		std::vector<uchar> file;
+		if (pfr->compact && pbkg==NULL && img.total()>1 && background_file(arg, file))
+			img.release();
+		// swap, then stop any previous video or generator outside the lock
+		pthread_mutex_lock(&pfr->lock);
+		capinfo_t *old = pfr->pbkg;
+		procinfo_t *oldgen = pfr->pgen;
+		pfr->pbkg = pbkg;
+		pfr->pgen = pgen;
+		pfr->bgimg = img;
+		pfr->bgfile.swap(file);
+		if (pbkg==NULL && pgen==NULL)
+			background_fit(pfr);
+		pthread_mutex_unlock(&pfr->lock);
+		if (old!=NULL)
+			capture_stop(old);
+		if (oldgen!=NULL)
+			procbg_stop(oldgen);
+		pthread_mutex_lock(&prc->lock);
+		prc->back = arg;
+		pthread_mutex_unlock(&prc->lock);
+	} else if (strcmp(cmd, "status")==0) {
+		pthread_mutex_lock(&prc->lock);
+		snprintf(buf, sizeof(buf), "model=%s size=%dx%d threads=%d rate=%d background=%s",
+			prc->model.c_str(), prc->w, prc->h, prc->tflite, prc->rate, prc->back.c_str());
+		pthread_mutex_unlock(&prc->lock);
+		reply = buf;
+	} else {
+		reply = "commands: threads <n>, model <file>|hog, rate <fps>, background <file>|proc:<kind>|green, size <w>x<h>, status";
+		return false;
+	}
+	return true;
+}
+
 int main(int argc, char* argv[]) {
 
 	printf("deepseg v0.2.1\n");
 	printf("(c) 2021 by floe@butterbrot.org - https://github.com/floe/deepseg\n");
 	printf("(c) 2021 by phil.github@ashbysoft.com - https://github.com/phlash/deepseg\n");
 
+	int64 start = cv::getTickCount();
 	signal(SIGSEGV, trap);
 	signal(SIGABRT, trap);
 	int debug  = 0;
-	int threads= 2;
+	int threads= 0;
+	int cpus   = 0;
+	int dlms   = 0;
 	int width  = 640;
 	int height = 480;
 	const char *back = nullptr; // "images/background.png";
 	const char *vcam = "/dev/video0";
 	const char *ccam = "/dev/video1";
+	const char *ctlpath = nullptr;
 	bool flipHorizontal = false;
 	bool flipVertical   = false;
+	bool degrade = true;
+	bool sync = false;
+	bool zygote = false;
+	int resident = 0;
+	int maxmem = 0;
 
 	bool usehog = false;
 	const char* modelname = "models/segm_full_v679.tflite";
+	bool modelset = false;
+	const char *tuneclip = nullptr;
+	schedpol_t pols[STAGE_COUNT];
+	schedpol_init(pols);
 
 	bool showUsage = false;
 	for (int arg=1; arg<argc; arg++) {
 		bool hasArgument = arg+1 < argc;
-		if (strncmp(argv[arg], "-?", 2)==0) {
+		if (strncmp(argv[arg], "--autotune", 10)==0) {
+			tuneclip = argv[arg][10]=='=' ? argv[arg]+11 : "images/orac.mp4";
+		} else if (strncmp(argv[arg], "--max-memory=", 13)==0) {
+			if (sscanf(argv[arg]+13, "%d", &maxmem)!=1 || maxmem<=0) {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "-?", 2)==0) {
 			showUsage = true;
 		} else if (strncmp(argv[arg], "-d", 2)==0) {
 			++debug;
@@ -163,6 +564,16 @@ int main(int argc, char* argv[]) {
 			flipVertical = true;
 		} else if (strncmp(argv[arg], "-g", 2)==0) {
 			usehog = true;
+		} else if (strncmp(argv[arg], "-q", 2)==0) {
+			degrade = false;
+		} else if (strncmp(argv[arg], "-A", 2)==0) {
+			sync = true;
+		} else if (strncmp(argv[arg], "-Z", 2)==0) {
+			zygote = true;
+		} else if (strncmp(argv[arg], "-R", 2)==0) {
+			resident |= RESIDENT_HUGE;
+		} else if (strncmp(argv[arg], "-L", 2)==0) {
+			resident |= RESIDENT_HUGE | RESIDENT_LOCK;
 		} else if (strncmp(argv[arg], "-v", 2)==0) {
 			if (hasArgument) {
 				vcam = argv[++arg];
@@ -175,6 +586,12 @@ int main(int argc, char* argv[]) {
 			} else {
 				showUsage = true;
 			}
+		} else if (strncmp(argv[arg], "-C", 2)==0) {
+			if (hasArgument) {
+				ctlpath = argv[++arg];
+			} else {
+				showUsage = true;
+			}
 		} else if (strncmp(argv[arg], "-b", 2)==0) {
 			if (hasArgument) {
 				back = argv[++arg];
@@ -184,6 +601,7 @@ int main(int argc, char* argv[]) {
 		} else if (strncmp(argv[arg], "-m", 2)==0) {
 			if (hasArgument) {
 				modelname = argv[++arg];
+				modelset = true;
 			} else {
 				showUsage = true;
 			}
@@ -203,9 +621,29 @@ int main(int argc, char* argv[]) {
 			} else {
 				showUsage = true;
 			}
+		} else if (strncmp(argv[arg], "-B", 2)==0) {
+			if (hasArgument && sscanf(argv[++arg], "%d", &cpus)) {
+				if (!cpus) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "-D", 2)==0) {
+			if (hasArgument && sscanf(argv[++arg], "%d", &dlms)) {
+				if (dlms<=0) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "-S", 2)==0) {
+			if (!hasArgument || !schedpol_parse(argv[++arg], pols)) {
+				showUsage = true;
+			}
 		} else if (strncmp(argv[arg], "-t", 2)==0) {
 			if (hasArgument && sscanf(argv[++arg], "%d", &threads)) {
-				if (!threads) {
+				if (threads<1) {
 					showUsage = true;
 				}
 			} else {
@@ -218,7 +656,8 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr, "\n");
 		fprintf(stderr, "usage:\n");
 		fprintf(stderr, "  deepseg [-?] [-d] [-c <capture>] [-v <virtual>] [-w <width>] [-h <height>]\n");
-		fprintf(stderr, "    [-t <threads>] [-b <background>] [-m <model>] [-g]\n");
+		fprintf(stderr, "    [-t <threads>] [-B <cpus>] [-D <ms>] [-q] [-A] [-R] [-L] [-Z] [-S <stage>=<policy>[:<prio>][@<cpus>]]..\n");
+		fprintf(stderr, "    [-b <background>] [-m <model>] [-g] [--autotune[=<clip>]] [-C <socket>] [--max-memory=<MB>]\n");
 		fprintf(stderr, "\n");
 		fprintf(stderr, "-?            Display this usage information\n");
 		fprintf(stderr, "-d            Increase debug level\n");
@@ -226,15 +665,31 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr, "-v            Specify the video target (sink) device\n");
 		fprintf(stderr, "-w            Specify the video stream width\n");
 		fprintf(stderr, "-h            Specify the video stream height\n");
-		fprintf(stderr, "-t            Specify the number of threads used for processing\n");
-		fprintf(stderr, "-b            Specify the background image\n");
+		fprintf(stderr, "-t            Specify the number of TFLite threads (default: from CPU budget)\n");
+		fprintf(stderr, "-B            Specify the CPU budget shared by all threads (default: all available)\n");
+		fprintf(stderr, "-D            Specify the capture to mask deadline (default: two frame intervals)\n");
+		fprintf(stderr, "-q            Disable automatic quality degradation under CPU pressure\n");
+		fprintf(stderr, "-A            Align video with its own mask by delaying it (adds latency)\n");
+		fprintf(stderr, "-R            Keep large buffers resident: huge pages, prefaulted and recycled\n");
+		fprintf(stderr, "-L            As -R, and lock buffers, tensor arena & model in memory\n");
+		fprintf(stderr, "-Z            Supervise: restart from a warm, preloaded model on crash or SIGHUP\n");
+		fprintf(stderr, "-S            Set a stage (capture|render, background, inference) scheduling policy\n");
+		fprintf(stderr, "              (other, batch, idle, fifo, rr), RT priority and/or CPU list\n");
+		fprintf(stderr, "-b            Specify the background image, video or proc:gradient|noise|parallax[:<div>]\n");
 		fprintf(stderr, "-m            Specify the TFLite model used for segmentation\n");
 		fprintf(stderr, "-H            Mirror the output horizontally\n");
 		fprintf(stderr, "-V            Mirror the output vertically\n");
 		fprintf(stderr, "-g            Use dlib's hoG facial detector, ignores Tensorflow model\n");
+		fprintf(stderr, "-C            Listen for live reconfiguration commands on a Unix socket\n");
+		fprintf(stderr, "--autotune    Pick model (unless -m) and thread split by benchmarking a clip, cached per CPU\n");
+		fprintf(stderr, "--max-memory  Fit a memory budget: small model (unless -m), fewer queued frames, compact background\n");
 		exit(1);
 	}
 
+	// constrained memory: smallest model unless one was given
+	if (maxmem && !modelset)
+		modelname = "models/segm_lite_v681.tflite";
+
 	printf("debug:  %d\n", debug);
 	printf("ccam:   %s\n", ccam);
 	printf("vcam:   %s\n", vcam);
@@ -244,105 +699,220 @@ int main(int argc, char* argv[]) {
 	printf("flip_v: %s\n", flipVertical ? "yes" : "no");
 	printf("usehog: %d\n", usehog);
 	printf("threads:%d\n", threads);
+	printf("cpus:   %d\n", cpus);
+	printf("dline:  %dms\n", dlms);
+	printf("degrade:%s\n", degrade ? "yes" : "no");
+	printf("sync:   %s\n", sync ? "aligned" : "lowest latency");
 	printf("back:   %s\n", back ? back : "(none)");
-	printf("model:  %s\n\n", modelname);
+	printf("model:  %s\n", modelname);
+	printf("tune:   %s\n", tuneclip ? tuneclip : "(none)");
+	printf("control:%s\n", ctlpath ? ctlpath : "(none)");
+	printf("cpu:    %s kernels\n", cpu_name(cpu_level()));
+	printf("memory: %s\n", (resident & RESIDENT_LOCK) ? "resident, locked" : resident ? "resident" : "default");
+	printf("zygote: %s\n", zygote ? "yes" : "no");
+	if (maxmem)
+		printf("maxmem: %dMB\n\n", maxmem);
+	else
+		printf("maxmem: (none)\n\n");
+
+	// before any pipeline buffers are allocated
+	resident_init(resident, debug);
+
+	// from here on, this is a worker with a warm pipeline
+	seginfo_t *pwarm = NULL;
+	if (zygote) {
+		if (tuneclip) {
+			fprintf(stderr, "Warning: --autotune ignored with -Z\n");
+			tuneclip = nullptr;
+		}
+		pwarm = zygote_run(modelname, usehog, width, height, debug);
+	}
 
 	// context data shared with callback
 	frame_ctx_t fctx;
-	fctx.lock = PTHREAD_MUTEX_INITIALIZER;
+	schedpol_mutex_init(&fctx.lock);
 	fctx.done = false;
 	fctx.debug = debug;
-	fctx.outw = width;
-	fctx.outh = height;
-	fctx.flip = (flipHorizontal? FLIP_HORZ: 0) | (flipVertical? FLIP_VERT: 0);
-	// open loopback virtual camera stream, always with YUV420p output
+	fctx.start = start;
+	fctx.shown = false;
+	fctx.lbw = fctx.outw = width;
+	fctx.lbh = fctx.outh = height;
+	int flip = (flipHorizontal? BLEND_FLIP_HORZ: 0) | (flipVertical? BLEND_FLIP_VERT: 0);
+	// with its own policy, the render thread blends by itself: OpenCV's
+	// workers are created by (and run at the policy of) the inference thread
+	if (pols[STAGE_CAPTURE].set || pols[STAGE_CAPTURE].pin || pols[STAGE_INFERENCE].set || pols[STAGE_INFERENCE].pin)
+		flip |= BLEND_SERIAL;
+	fctx.blend = blend_select(flip);
+	fctx.sync = sync;
+	fctx.compact = maxmem>0;
+	fctx.nframes = maxmem ? SMALL_FRAMES : SYNC_FRAMES;
+	fctx.nmasks = (maxmem && !sync) ? 2 : SYNC_MASKS;	// unaligned only reads the latest
+	fctx.delay = 0;
+	for (int f=0; f<SYNC_FRAMES; f++)
+		fctx.fseq[f] = -1;
+	// open loopback virtual camera stream, always with YUV420p output, and
+	// give readers a placeholder until the first composited frame
 	fctx.lbfd = loopback_init(vcam,width,height,debug);
-	// open capture device stream, pass in/out expected/actual size
-	int capw = width, caph = height, rate;
-	fctx.pcap = capture_init(ccam, &capw, &caph, &rate, debug);
-	TFLITE_MINIMAL_CHECK(fctx.pcap!=NULL);
-	printf("stream info: %dx%d @ %dfps\n", capw, caph, rate);
-
-	// setup background image/video
-	fctx.pbkg = NULL;
-	if (back && access(back, R_OK)==0) {
-		int bkgw = width, bkgh = height;
-		// check background file extension (yeah, I know) to spot videos..
-		char *dot = rindex((char*)back, '.');
-		if (dot!=NULL &&
-			(strcasecmp(dot, ".png")==0 ||
-			 strcasecmp(dot, ".jpg")==0 ||
-			 strcasecmp(dot, ".jpeg")==0)) {
-			// read background into raw BGR24 format, resize to output
-			fctx.bg = cv::imread(back);
-			cv::resize(fctx.bg,fctx.bg,cv::Size(width,height));
+	cv::Mat holding(height,width,CV_8UC3,cv::Scalar(0,255,0));
+	loopback_write(fctx.lbfd, holding);
+	if (debug)
+		printf("startup: placeholder after %.0fms\n", ms_since(start));
+
+	// open capture device and background alongside the setup below
+	startup_t st;
+	st.ccam = ccam;
+	st.back = back;
+	st.usehog = usehog;
+	st.w = width;
+	st.h = height;
+	st.debug = debug;
+	pthread_t tcap, tbkg, tseg;
+	TFLITE_MINIMAL_CHECK(pthread_create(&tcap, NULL, start_capture, &st)==0);
+	TFLITE_MINIMAL_CHECK(pthread_create(&tbkg, NULL, start_background, &st)==0);
+	bool capready = false;
+
+	// share CPUs between render/decode threads, TFLite and OpenCV
+	// (cgroup quota & cpuset aware unless -B given), going by the background
+	// file type until it is open
+	bool bgvideo = background_video(back);
+	budget_t budget;
+	int tfwant = threads, cvwant = 0;
+	budget_init(&budget, cpus, bgvideo, tfwant, cvwant, debug);
+
+	// autotune model & thread split against capture frame rate
+	if (tuneclip && !usehog) {
+		pthread_join(tcap, NULL);
+		capready = true;
+		TFLITE_MINIMAL_CHECK(st.pcap!=NULL);
+		std::vector<const char *> models;
+		if (modelset) {
+			models.push_back(modelname);
 		} else {
-			// assume video background..start capture
-			fctx.pbkg = capture_init(back, &bkgw, &bkgh, &rate, debug);
-			TFLITE_MINIMAL_CHECK(fctx.pbkg!=NULL);
+			models.push_back("models/segm_lite_v509_128x128_opt_float32.tflite");
+			models.push_back("models/segm_lite_v681.tflite");
+			if (!maxmem) {
+				models.push_back("models/segm_full_v679_144x256_opt_float32.tflite");
+				models.push_back("models/segm_full_v679.tflite");
+			}
 		}
-	} else {
-		// default background to green screen
-		if (back) {
-			fprintf(stderr, "Warning: could not load background image, defaulting to green\n");
+		tuneinfo_t tune;
+		budget_t all;
+		budget_init(&all, cpus, bgvideo, 0, 0, 0);
+		if (tune_config(tuneclip, modelname, models, width, height, all.tflite, 1000.0/st.rate, 0.9, &tune, debug)) {
+			modelname = strdup(tune.model.c_str());
+			tfwant = tune.tfthreads;
+			cvwant = tune.cvthreads;
+			budget_init(&budget, cpus, bgvideo, tfwant, cvwant, debug);
+		} else {
+			fprintf(stderr, "Warning: autotune failed, using defaults\n");
 		}
-		fctx.bg = cv::Mat(height,width,CV_8UC3,cv::Scalar(0,255,0));
 	}
 
-	// Are we flowing or hogging?
-	hoginfo_t *phg = NULL;
-	tfinfo_t *ptf = NULL;
-	cv::Mat input;
-	cv::Mat output;
-	cv::Rect roidim;
-	if (usehog) {
-		// Load HOG
-		phg = hog_init(debug);
-	} else {
-		// Load TF model
-		ptf = tf_init(modelname, threads, debug);
-
-		// wrap input and output tensor with cv::Mat
-		tfbuffer_t *tbuf = tf_get_buffer(ptf, TFINFO_BUF_IN);
-		input = cv::Mat(tbuf->h, tbuf->w, CV_32FC(tbuf->c), tbuf->data);
-		delete tbuf;
-		tbuf = tf_get_buffer(ptf, TFINFO_BUF_OUT);
-		output = cv::Mat(tbuf->h, tbuf->w, CV_32FC(tbuf->c), tbuf->data);
-		delete tbuf;
-		// https://stackoverflow.com/questions/13384594/fit-a-rectangle-into-another-rectangle
-		float imgRatio = (float)width/(float)height;
-		float modRatio = (float)output.cols/(float)output.rows;
-		float resize = (modRatio>imgRatio) ?
-			(float)width/(float)output.cols :
-			(float)height/(float)output.rows;
-		float roiWidth = (float)output.cols * resize;
-		float roiHeight = (float)output.rows * resize;
-		roidim = cv::Rect((int)(width-roiWidth)/2,(int)(height-roiHeight)/2,(int)roiWidth,(int)roiHeight);
-		printf("roidim(x,y,w,h)=(%d,%d,%d,%d)\n",roidim.x,roidim.y,roidim.width,roidim.height);
-	}
+	// inference stage policy on this thread first, so that OpenCV's pool
+	// and TFLite's workers (both created lazily from here) inherit it
+	schedpol_apply(pthread_self(), &pols[STAGE_INFERENCE], "inference", debug);
+	budget_apply(&budget);
 
-	// initialize mask and ROI in center (only used for TF but need to exist)
-	cv::Mat mask = cv::Mat::zeros(height,width,CV_32FC1);
-	cv::Mat mroi = mask(roidim);
-	mask.copyTo(fctx.mask);
+	// Load segmentation pipeline (HOG or TF model), the loader thread
+	// inherits the inference policy too
+	st.modelname = modelname;
+	st.threads = budget.tflite;
+	st.pseg = pwarm;
+	if (!pwarm)
+		TFLITE_MINIMAL_CHECK(pthread_create(&tseg, NULL, start_model, &st)==0);
+
+	if (!capready)
+		pthread_join(tcap, NULL);
+	pthread_join(tbkg, NULL);
+	fctx.pcap = st.pcap;
+	TFLITE_MINIMAL_CHECK(fctx.pcap!=NULL);
+	int rate = st.rate;
+	printf("stream info: %dx%d @ %dfps\n", st.capw, st.caph, rate);
+	fctx.pbkg = st.pbkg;
+	fctx.pgen = st.pgen;
+	fctx.bgimg = st.bgimg;
+	bool bgok = st.bgok;
+	if (fctx.compact && fctx.pbkg==NULL && bgok && background_file(back, fctx.bgfile))
+		fctx.bgimg.release();
+	// resize static background to output
+	if (fctx.pbkg==NULL && fctx.pgen==NULL)
+		background_fit(&fctx);
 
-	// erosion/dilation elements
-	cv::Mat element3 = cv::getStructuringElement( cv::MORPH_ELLIPSE, cv::Size(3,3) );
-	cv::Mat element7 = cv::getStructuringElement( cv::MORPH_ELLIPSE, cv::Size(7,7) );
-	cv::Mat element11 = cv::getStructuringElement( cv::MORPH_ELLIPSE, cv::Size(11,11) );
+	// capture/render & background decode stage policies
+	schedpol_apply(capture_tid(fctx.pcap), &pols[STAGE_CAPTURE], "capture", debug);
+	if (fctx.pbkg!=NULL)
+		schedpol_apply(capture_tid(fctx.pbkg), &pols[STAGE_BACKGROUND], "background", debug);
 
-	// label number of "person" for DeepLab v3+ model
-	const int cnum = labels.size();
-	const int pers = std::find(labels.begin(),labels.end(),"person") - labels.begin();
+	// initialize masks (zero until first inference completes)
+	cv::Mat mask = cv::Mat::zeros(height,width,CV_32FC1);
+	for (int m=0; m<fctx.nmasks; m++) {
+		mask.copyTo(fctx.mask[m]);
+		fctx.mseq[m] = 0;
+	}
+	fctx.mlast = 0;
+	float lag = 0;
 
-	// attach input frame callback
+	// attach input frame callback, so the virtual camera shows the
+	// background while the model is still loading
 	capture_setcb(fctx.pcap, process_frame, &fctx);
 
+	if (!pwarm)
+		pthread_join(tseg, NULL);
+	seginfo_t *pseg = st.pseg;
+	TFLITE_MINIMAL_CHECK(pseg!=NULL);
+	if ((fctx.pbkg!=NULL) != bgvideo) {
+		budget_init(&budget, cpus, fctx.pbkg!=NULL, tfwant, cvwant, debug);
+		budget_apply(&budget);
+	}
+	// (a warm pipeline was built single threaded)
+	if (pwarm || ((fctx.pbkg!=NULL) != bgvideo))
+		seg_set_threads(pseg, budget.tflite);
+	printf("pipeline: source(%s) -> %s -> composite(%s) -> sink(%s)\n",
+		ccam, seg_chain(pseg), blend_name(flip), vcam);
+	if (debug)
+		printf("startup: capture %.0fms, background %.0fms, model %.0fms (in parallel), ready after %.0fms\n",
+			st.tcap, st.tbkg, st.tseg, ms_since(start));
+
+	// live reconfiguration
+	reconf_t rc;
+	pthread_mutex_init(&rc.lock, NULL);
+	rc.pfr = &fctx;
+	rc.pols = pols;
+	rc.model = usehog ? "hog" : modelname;
+	rc.back = bgok ? back : "green";
+	rc.w = width;
+	rc.h = height;
+	rc.tflite = budget.tflite;
+	rc.rate = 0;
+	rc.pseg = NULL;
+	rc.threads = 0;
+	rc.debug = debug;
+	ctlinfo_t *pctl = NULL;
+	if (ctlpath) {
+		pctl = control_init(ctlpath, control_cmd, &rc, debug);
+		if (pctl==NULL)
+			fprintf(stderr, "Warning: could not open control socket, live reconfiguration disabled\n");
+	}
+
+	// latest-frame-wins deadline scheduling
+	deadline_t dl;
+	deadline_init(&dl, dlms ? dlms : 2000.0/rate);
+	// step down postprocessing quality when frames overrun their interval
+	degrade_t dg;
+	degrade_init(&dg, 1000.0/rate, degrade);
+
 	// stats
 	int64 es = cv::getTickCount();
 	int64 e1 = es;
+	int64 ecg = es;
+	int64 emem = es;
 	int64 fr = 0;
 	int64 lcap = 0;
+	long pf = resident_faults();
+	cginfo_t cg0, cg;
+	if (cgroup_read(&cg0) && debug)
+		printf("cgroup: quota %.2f cpuset %d => %d cpus\n", cg0.quota, cg0.cpuset, cg0.cpus);
+	cg = cg0;
 	while (!fctx.done) {
 
 		// wait for next capture frame (we might be quicker than input rate now!)
@@ -352,114 +922,139 @@ int main(int argc, char* argv[]) {
 		}
 		lcap = capture_count(fctx.pcap);
 
-		// grab last captured frame
+		// pick up live reconfiguration
+		pthread_mutex_lock(&rc.lock);
+		seginfo_t *pnew = rc.pseg;
+		int nw = rc.pw, nh = rc.ph, nthreads = rc.threads, irate = rc.rate;
+		rc.pseg = NULL;
+		rc.threads = 0;
+		pthread_mutex_unlock(&rc.lock);
+		if (pnew!=NULL) {
+			if (nw!=width || nh!=height) {
+				// carry existing masks & background over to the new size
+				width = nw;
+				height = nh;
+				pthread_mutex_lock(&fctx.lock);
+				fctx.outw = width;
+				fctx.outh = height;
+				for (int m=0; m<fctx.nmasks; m++)
+					cv::resize(fctx.mask[m],fctx.mask[m],cv::Size(width,height));
+				for (int f=0; f<SYNC_FRAMES; f++)
+					fctx.fseq[f] = -1;
+				if (fctx.pbkg==NULL && fctx.pgen==NULL)
+					background_fit(&fctx);
+				pthread_mutex_unlock(&fctx.lock);
+				mask = cv::Mat::zeros(height,width,CV_32FC1);
+			}
+			seg_stop(pseg);
+			pseg = pnew;
+			seg_set_quality(pseg, degrade_flags(dg.level));
+			printf("\npipeline: %s @ %dx%d\n", seg_chain(pseg), width, height);
+		}
+		if (nthreads) {
+			tfwant = nthreads;
+			budget_init(&budget, cpus, fctx.pbkg!=NULL, tfwant, cvwant, debug);
+			budget_apply(&budget);
+			seg_set_threads(pseg, budget.tflite);
+			pthread_mutex_lock(&rc.lock);
+			rc.tflite = budget.tflite;
+			pthread_mutex_unlock(&rc.lock);
+		}
+
+		// grab last captured frame, skip it if already past its deadline
 		cv::Mat cap;
-		capture_frame(fctx.pcap, cap);
+		int64 seq, ts;
+		capture_frame(fctx.pcap, cap, &seq, &ts);
+		int step = degrade_rate(dg.level);
+		if (irate && irate < rate)
+			step = std::max(step, (rate+irate-1)/irate);
+		if (seq % step) {
+			deadline_skip(&dl, seq);
+			continue;
+		}
+		if (!deadline_start(&dl, seq, ts))
+			continue;
+		if (cap.cols != width || cap.rows != height)
+			cv::resize(cap,cap,cv::Size(width,height));
 
-		// HOG or TF sir?
-		if (usehog) {
-			// Resize to output if required
-			if (cap.cols != fctx.outw || cap.rows != fctx.outh)
-				cv::resize(cap,cap,cv::Size(fctx.outw,fctx.outh));
+		// segment frame into mask, jumping to a newer frame rather than
+		// starting inference that cannot finish in time
+		int64 t0 = cv::getTickCount();
+		TFLITE_MINIMAL_CHECK(seg_prepare(pseg, cap));
+		if (!deadline_infer(&dl, ts, capture_seq(fctx.pcap)!=seq))
+			continue;
+		TFLITE_MINIMAL_CHECK(seg_infer(pseg));
+		int64 t1 = cv::getTickCount();
+		TFLITE_MINIMAL_CHECK(seg_mask(pseg, mask));
+		int64 t2 = cv::getTickCount();
 
-			// Run HOG to rough mask
-			TFLITE_MINIMAL_CHECK(hog_faces(phg, cap, output));
+		// aligned: delay video by the frames captured while masks are made
+		lag = (lag*7 + (float)(capture_seq(fctx.pcap)-seq))/8;
 
-			// smooth mask..
-			if (!output.empty() && getenv("DEEPSEG_NOBLUR")==NULL)
-				cv::blur(output,mask,cv::Size(7,7));
-		} else {
-			// map ROI
-			cv::Mat roi = cap(roidim);
-			// convert BGR to RGB, resize ROI to input size
-			cv::Mat in_u8_rgb, in_resized;
-			cv::cvtColor(roi,in_u8_rgb,CV_BGR2RGB);
-			// TODO: can convert directly to float?
-			cv::resize(in_u8_rgb,in_resized,cv::Size(input.cols,input.rows));
-			if (debug > 2) cv::imshow("input",in_resized);
-
-			// convert to float and normalize values to [-1;1]
-			in_resized.convertTo(input,CV_32FC3,1.0/128.0,-1.0);
-
-			// Run inference
-			TFLITE_MINIMAL_CHECK(tf_infer(ptf));
-
-			// create Mat for small mask
-			cv::Mat ofinal(output.rows,output.cols,CV_32FC1);
-			float* tmp = (float*)output.data;
-			float* out = (float*)ofinal.data;
-
-			// find class with maximum probability
-			if (strstr(modelname, "deeplab")) {
-				for (unsigned int n = 0; n < output.total(); n++) {
-					float maxval = -10000; int maxpos = 0;
-					for (int i = 0; i < cnum; i++) {
-						if (tmp[n*cnum+i] > maxval) {
-							maxval = tmp[n*cnum+i];
-							maxpos = i;
-						}
-					}
-					// set mask to 1.0 where class == person
-					out[n] = (maxpos==pers ? 1.0 : 0);
-				}
-			} else if (strstr(modelname,"body-pix")) {
-				for (unsigned int n = 0; n < output.total(); n++) {
-					if (tmp[n] < 0.65) out[n] = 0; else out[n] = 1.0;
-				}
-			} else if (strstr(modelname,"segm_")) {
-				// Google Meet segmentation network
-					/* 256 x 144 x 2 tensor for the full model or 160 x 96 x 2
-					 * tensor for the light model with masks for background
-					 * (channel 0) and person (channel 1) where values are in
-					 * range [MIN_FLOAT, MAX_FLOAT] and user has to apply
-					 * softmax across both channels to yield foreground
-					 * probability in [0.0, 1.0]. */
-				for (unsigned int n = 0; n < output.total(); n++) {
-					float exp0 = expf(tmp[2*n  ]);
-					float exp1 = expf(tmp[2*n+1]);
-					float p0 = exp0 / (exp0+exp1);
-					float p1 = exp1 / (exp0+exp1);
-					if (p0 < p1) out[n] = 1.0; else out[n] = 0;
-				}
-			}
-			if (debug > 2) cv::imshow("ofinal",ofinal);
-
-			// denoise, close & open with small then large elements, adapted from:
-			// https://stackoverflow.com/questions/42065405/remove-noise-from-threshold-image-opencv-python
-			if (getenv("DEEPSEG_NODENOISE")==NULL) {
-				cv::morphologyEx(ofinal,ofinal,CV_MOP_CLOSE,element3);
-				cv::morphologyEx(ofinal,ofinal,CV_MOP_OPEN,element3);
-				cv::morphologyEx(ofinal,ofinal,CV_MOP_CLOSE,element7);
-				cv::morphologyEx(ofinal,ofinal,CV_MOP_OPEN,element7);
-				cv::dilate(ofinal,ofinal,element7);
-			}
-			// smooth mask edges
-			if (getenv("DEEPSEG_NOBLUR")==NULL)
-				cv::blur(ofinal,ofinal,cv::Size(7,7));
-			// scale up into full-sized mask
-			cv::resize(ofinal,mroi,cv::Size(mroi.cols,mroi.rows));
-		}
-		// update mask for render thread (under lock)
+		// publish mask for render thread (under lock)
 		pthread_mutex_lock(&fctx.lock);
-		mask.copyTo(fctx.mask);
+		int next = (fctx.mlast+1) % fctx.nmasks;
+		mask.copyTo(fctx.mask[next]);
+		fctx.mseq[next] = seq;
+		fctx.mlast = next;
+		if (fctx.sync)
+			fctx.delay = std::min((int)ceilf(lag), fctx.nframes-1);
 		pthread_mutex_unlock(&fctx.lock);
+		deadline_done(&dl, ts);
+		seg_set_quality(pseg, degrade_flags(degrade_update(&dg, t1-t0, t2-t1)));
+		if (!fr) {
+			printf("startup: first mask after %.0fms\n", ms_since(start));
+			memory_report(&fctx, pseg, maxmem);
+		}
 		++fr;
 
+		// re-check container limits every couple of seconds, resizing
+		// thread pools if our CPU allowance changed under us
+		int64 e2 = cv::getTickCount();
+		if ((debug || maxmem) && (e2-emem)/cv::getTickFrequency() > 30.0) {
+			emem = e2;
+			memory_report(&fctx, pseg, maxmem);
+		}
+		if ((e2-ecg)/cv::getTickFrequency() > 2.0) {
+			ecg = e2;
+			cgroup_read(&cg);
+			if (!cpus && cg.cpus!=budget.total) {
+				printf("\ncgroup: CPU limit now %d (quota %.2f, cpuset %d), resizing\n", cg.cpus, cg.quota, cg.cpuset);
+				budget_init(&budget, cg.cpus, fctx.pbkg!=NULL, tfwant, cvwant, debug);
+				budget_apply(&budget);
+				seg_set_threads(pseg, budget.tflite);
+				pthread_mutex_lock(&rc.lock);
+				rc.tflite = budget.tflite;
+				pthread_mutex_unlock(&rc.lock);
+			}
+		}
+
 		if (!debug) { printf("."); fflush(stdout); continue; }
 
-		int64 e2 = cv::getTickCount();
+		// page faults since the previous mask
+		long pf2 = resident_faults();
+		long pfd = pf2-pf;
+		pf = pf2;
 		float el = (e2-e1)/cv::getTickFrequency();
 		float t = (e2-es)/cv::getTickFrequency();
 		e1 = e2;
 		int64 rcnt = capture_count(fctx.pcap);
 		int64 bcnt = fctx.pbkg!=NULL ? capture_count(fctx.pbkg) : 0;
-		printf("\relapsed:%0.3f gr=%ld gps:%3.1f br=%ld fr=%ld fps:%3.1f   ",
-			el, rcnt, rcnt/t, bcnt, fr, fr/t);
+		printf("\relapsed:%0.3f gr=%ld gps:%3.1f br=%ld fr=%ld fps:%3.1f q=%d drop=%ld late=%ld sync=%dms thr=%ld/%ldms pf=%ld   ",
+			el, rcnt, rcnt/t, bcnt, fr, fr/t, dg.level, dl.dropped, dl.late, fctx.delay*1000/rate,
+			(long)(cg.nr_throttled-cg0.nr_throttled), (long)((cg.throttled_us-cg0.throttled_us)/1000), pfd);
 		fflush(stdout);
 	}
+	if (pctl!=NULL)
+		control_stop(pctl);
 	capture_stop(fctx.pcap);
 	if (fctx.pbkg!=NULL)
 		capture_stop(fctx.pbkg);
+	if (fctx.pgen!=NULL)
+		procbg_stop(fctx.pgen);
+	if (rc.pseg!=NULL)
+		seg_stop(rc.pseg);
+	seg_stop(pseg);
 
 	return 0;
 }
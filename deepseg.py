@@ -14,6 +14,9 @@
 # limitations under the License.
 # ==============================================================================
 
+# Thin driver over the _deepseg extension (make _deepseg): capture, display
+# and file I/O here, segmentation & compositing in C++ on the numpy buffers
+
 from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
@@ -21,93 +24,83 @@ from __future__ import print_function
 import argparse
 import cv2
 import numpy as np
-import tensorflow as tf # TF2
-
-# category labels for deeplabv3_257_mv_gpu.tflite
-labels = [ "background", "aeroplane", "bicycle", "bird", "boat", "bottle", "bus", "car", "cat", "chair", "cow", "dining table", "dog", "horse", "motorbike", "person", "potted plant", "sheep", "sofa", "train", "tv" ]
+import _deepseg
 
 if __name__ == '__main__':
 
-  cap = cv2.VideoCapture(0)
-  bg = cv2.imread("bauhaus_nothing.jpg")
-
-  print("using NumPy  version "+np.__version__)
-  print("using TFLite version "+tf.__version__)
-
   parser = argparse.ArgumentParser()
   parser.add_argument(
-      '-i',
-      '--image',
-      default='grace_hopper.bmp',
-      help='image to be classified')
+      '-c',
+      '--capture',
+      default='0',
+      help='camera index or video file')
+  parser.add_argument(
+      '-o',
+      '--output',
+      help='write composited video here instead of displaying it')
+  parser.add_argument(
+      '-b',
+      '--background',
+      help='background image (default green)')
   parser.add_argument(
       '-m',
       '--model_file',
-      default='deeplabv3_257_mv_gpu.tflite',
+      default='models/segm_full_v679.tflite',
       help='.tflite model to be executed')
   parser.add_argument(
-      '--input_mean',
-      default=127.5, type=float,
-      help='input_mean')
+      '-t',
+      '--threads',
+      default=0, type=int,
+      help='TFLite threads')
   parser.add_argument(
-      '--input_std',
-      default=127.5, type=float,
-      help='input standard deviation')
+      '-n',
+      '--batch',
+      default=1, type=int,
+      help='frames per batch')
   args = parser.parse_args()
 
-  interpreter = tf.lite.Interpreter(model_path=args.model_file)
-  interpreter.allocate_tensors()
-
-  input_details = interpreter.get_input_details()
-  output_details = interpreter.get_output_details()
-
-  # check the type of the input tensor
-  floating_model = input_details[0]['dtype'] == np.float32
-
-  # NxHxWxC, H:1, W:2
-  height = input_details[0]['shape'][1]
-  width = input_details[0]['shape'][2]
-
-  while True:
+  cap = cv2.VideoCapture(int(args.capture) if args.capture.isdigit() else args.capture)
+  width = int(cap.get(cv2.CAP_PROP_FRAME_WIDTH))
+  height = int(cap.get(cv2.CAP_PROP_FRAME_HEIGHT))
+  print("using NumPy  version "+np.__version__)
+  print("stream: %dx%d" % (width, height))
+
+  seg = _deepseg.Segmenter(width, height, model=args.model_file, threads=args.threads)
+  if args.background:
+    seg.set_background(cv2.imread(args.background))
+  out = None
+  if args.output:
+    out = cv2.VideoWriter(args.output, cv2.VideoWriter_fourcc(*'mp4v'), cap.get(cv2.CAP_PROP_FPS) or 30, (width, height))
+
+  # frames are composited in place, in batches of preallocated buffers
+  frames = np.empty((args.batch, height, width, 3), np.uint8)
+  done = False
+  while not done:
     e1 = cv2.getTickCount()
-
-    ret, img = cap.read()
-    roi = img[0:540,210:750] # row0:row1, col0:col1
-    img = cv2.resize(roi,(width,height))
-    #img = cv2.resize(cv2.imread(args.image),(width,height))
-
-    # add N dim
-    input_data = np.expand_dims(img, axis=0)
-
-    if floating_model:
-      input_data = (np.float32(input_data) - args.input_mean) / args.input_std
-
-    interpreter.set_tensor(input_details[0]['index'], input_data)
-
-    interpreter.invoke()
-
-    output_data = interpreter.get_tensor(output_details[0]['index'])
-    results = np.squeeze(output_data)
-
-    # find the highest-probability class for each pixel (along axis 2)
-    out = np.apply_along_axis(np.argmax,2,results)
-      
-    # set pixels with likeliest class == person to 255
-    pers_idx = labels.index("person")
-    person = np.where(out == pers_idx, 255, 0).astype(np.uint8)
-
-    # use mask to combine with background
-    tmp1 = cv2.bitwise_and(img, img, mask=person)
-    tmp2 = cv2.bitwise_and(bg, bg, mask=~person)
-    img = cv2.add(tmp1,tmp2)
+    n = 0
+    while n < args.batch:
+      ret, _ = cap.read(frames[n])
+      if not ret:
+        done = True
+        break
+      n += 1
+    if n == 0:
+      break
+    seg.process_batch(frames[:n], out=frames[:n])
 
     e2 = cv2.getTickCount()
     t = (e2 - e1)/cv2.getTickFrequency()
-    print("total runtime: "+str(t))
+    print("total runtime: %.3f (%d frames)" % (t, n))
 
-    cv2.imshow("input",img)
-    if cv2.waitKey(1) & 0xFF == ord('q'):
-      break
+    for f in range(n):
+      if out is not None:
+        out.write(frames[f])
+      else:
+        cv2.imshow("output",frames[f])
+        if cv2.waitKey(1) & 0xFF == ord('q'):
+          done = True
 
   cap.release()
+  if out is not None:
+    out.release()
   cv2.destroyAllWindows()
@@ -0,0 +1,79 @@
+// Graceful degradation under CPU pressure: step down the postprocessing
+// quality ladder when frames persistently overrun their budget, and back up
+// once there is headroom again.
+#include <stdio.h>
+#include <math.h>
+
+#include "degrade.h"
+#include "segment.h"
+
+#define DEGRADE_DOWN	5	// consecutive frames over budget to step down
+#define DEGRADE_UP		60	// consecutive frames with headroom to step up
+#define DEGRADE_HEADROOM 0.7	// fraction of budget that counts as headroom
+#define DEGRADE_DEFAULT_MS (1000.0/30)	// frame time at a typical 30fps
+
+static const char *names[DEGRADE_LEVELS] = { "full", "no large morphology", "no blur", "fast upscale", "half rate" };
+
+void degrade_init(degrade_t *pdg, double budget_ms, bool enabled) {
+	// an unusable budget would silently never step down
+	if (enabled && (!(budget_ms>0) || !isfinite(budget_ms))) {
+		fprintf(stderr, "Warning: invalid frame budget, using %.1fms\n", DEGRADE_DEFAULT_MS);
+		budget_ms = DEGRADE_DEFAULT_MS;
+	}
+	pdg->level = DEGRADE_FULL;
+	pdg->budget = (int64)(budget_ms*cv::getTickFrequency()/1000.0);
+	pdg->infer = pdg->post = 0;
+	pdg->over = pdg->under = 0;
+	pdg->enabled = enabled;
+}
+
+// the budget is the same at every level: half rate is only left once a
+// frame fits within the headroom at full rate, so it can't flip back and
+// forth with the level above on a steady load
+int degrade_update(degrade_t *pdg, int64 infer, int64 post) {
+	if (!pdg->enabled)
+		return pdg->level;
+	pdg->infer = pdg->infer ? (pdg->infer*7+infer)/8 : infer;
+	pdg->post = pdg->post ? (pdg->post*7+post)/8 : post;
+	int64 took = pdg->infer + pdg->post, budget = pdg->budget;
+	if (took > budget) {
+		pdg->under = 0;
+		++pdg->over;
+	} else if (took < budget*DEGRADE_HEADROOM) {
+		pdg->over = 0;
+		++pdg->under;
+	} else {
+		pdg->over = pdg->under = 0;
+	}
+	int level = pdg->level;
+	// the postprocessing levels can't help if inference alone overruns
+	if (pdg->over >= DEGRADE_DOWN && level < DEGRADE_LEVELS-1)
+		level = pdg->infer > budget ? DEGRADE_HALFRATE : level+1;
+	else if (pdg->under >= DEGRADE_UP && level > DEGRADE_FULL)
+		--level;
+	if (level != pdg->level) {
+		printf("\ndegrade: level %d (%s) -> %d (%s), frame %.1fms (inference %.1fms) budget %.1fms\n",
+			pdg->level, names[pdg->level], level, names[level], took*1000.0/cv::getTickFrequency(),
+			pdg->infer*1000.0/cv::getTickFrequency(), budget*1000.0/cv::getTickFrequency());
+		pdg->level = level;
+		pdg->over = pdg->under = 0;
+	}
+	return pdg->level;
+}
+
+// segmentation quality flags for a level
+int degrade_flags(int level) {
+	int flags = 0;
+	if (level >= DEGRADE_NOLARGE)
+		flags |= SEG_NOLARGE;
+	if (level >= DEGRADE_NOBLUR)
+		flags |= SEG_NOBLUR;
+	if (level >= DEGRADE_FASTSCALE)
+		flags |= SEG_FASTSCALE;
+	return flags;
+}
+
+// infer every n'th frame
+int degrade_rate(int level) {
+	return level >= DEGRADE_HALFRATE ? 2 : 1;
+}
@@ -0,0 +1,28 @@
+#ifndef _DEGRADE_H_
+#define _DEGRADE_H_
+
+#include <opencv2/core.hpp>
+
+// degradation ladder, each level includes those below it
+#define DEGRADE_FULL		0	// full quality
+#define DEGRADE_NOLARGE		1	// drop large-kernel morphology
+#define DEGRADE_NOBLUR		2	// drop mask blur
+#define DEGRADE_FASTSCALE	3	// nearest neighbour mask upscale
+#define DEGRADE_HALFRATE	4	// infer every other frame
+#define DEGRADE_LEVELS		5
+
+// controller watching per-frame time against a budget
+typedef struct {
+	int level;
+	int64 budget;		// ticks per captured frame
+	int64 infer, post;	// per-frame inference & postprocessing time (EWMA, ticks)
+	int over, under;	// consecutive frames over/under budget
+	bool enabled;
+} degrade_t;
+
+void degrade_init(degrade_t *pdg, double budget_ms, bool enabled);
+int degrade_update(degrade_t *pdg, int64 infer, int64 post);
+int degrade_flags(int level);
+int degrade_rate(int level);
+
+#endif // _DEGRADE_H_
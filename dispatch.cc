@@ -0,0 +1,40 @@
+// CPU feature detection for kernel dispatch
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "dispatch.h"
+
+static int detect() {
+	int level = CPU_BASE;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		level = CPU_SSE42;
+	if (level==CPU_SSE42 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		level = CPU_AVX2;
+	if (level==CPU_AVX2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+		__builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+		level = CPU_AVX512;
+#endif
+	// allow capping, e.g. to compare variants or avoid AVX-512 downclocking
+	const char *cap = getenv("DEEPSEG_CPU");
+	if (cap) {
+		for (int l=0; l<CPU_LEVELS; l++) {
+			if (strcasecmp(cap, cpu_name(l))==0 && l<level)
+				level = l;
+		}
+	}
+	return level;
+}
+
+int cpu_level() {
+	// thread-safe one time initialisation (C++11 static)
+	static int level = detect();
+	return level;
+}
+
+const char *cpu_name(int level) {
+	static const char *names[CPU_LEVELS] = { "base", "sse4.2", "avx2", "avx512" };
+	return (level>=0 && level<CPU_LEVELS) ? names[level] : "unknown";
+}
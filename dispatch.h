@@ -0,0 +1,41 @@
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+// runtime CPU feature dispatch: hot kernels are compiled once per ISA level
+// and the best one the running CPU supports is picked at startup, so one
+// (baseline x86-64) build runs well across machines
+#define CPU_BASE	0	// x86-64 baseline (SSE2)
+#define CPU_SSE42	1
+#define CPU_AVX2	2	// AVX2 + FMA
+#define CPU_AVX512	3	// AVX-512 F/BW/DQ/VL
+#define CPU_LEVELS	4
+
+int cpu_level();			// detected (or DEEPSEG_CPU limited) level
+const char *cpu_name(int level);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_TARGET_SSE42	__attribute__((target("sse4.2,popcnt")))
+#define CPU_TARGET_AVX2		__attribute__((target("avx2,fma")))
+#define CPU_TARGET_AVX512	__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl")))
+#else
+#define CPU_TARGET_SSE42
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#endif
+
+// define <name>_base/_sse42/_avx2/_avx512 wrappers around an always_inline
+// kernel <name>, each compiled for its ISA, and a table of them by level
+#define CPU_VARIANTS(ret, name, params, args) \
+	static ret name##_base params { return name args; } \
+	CPU_TARGET_SSE42 static ret name##_sse42 params { return name args; } \
+	CPU_TARGET_AVX2 static ret name##_avx2 params { return name args; } \
+	CPU_TARGET_AVX512 static ret name##_avx512 params { return name args; } \
+	static ret (* const name##_variants[CPU_LEVELS]) params = \
+		{ name##_base, name##_sse42, name##_avx2, name##_avx512 };
+
+// best variant for this CPU
+#define CPU_SELECT(name) (name##_variants[cpu_level()])
+
+#define CPU_KERNEL inline __attribute__((always_inline))
+
+#endif // _DISPATCH_H_
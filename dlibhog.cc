@@ -18,14 +18,14 @@ struct _hoginfo_t {
     int debug;
 };
 
-hoginfo_t *hog_init(int debug) {
+static hoginfo_t *dlib_init(int debug) {
     hoginfo_t *phg = new hoginfo_t;
     phg->debug = debug;
     phg->det = dlib::get_frontal_face_detector();
     return phg;
 }
 
-bool hog_faces(hoginfo_t *phg, cv::Mat& img, cv::Mat& out) {
+static bool dlib_faces(hoginfo_t *phg, cv::Mat& img, cv::Mat& out) {
     // convert to dlib bgr image type
     dlib::cv_image<dlib::bgr_pixel> bgr(img);
     // detect faces!
@@ -53,6 +53,9 @@ bool hog_faces(hoginfo_t *phg, cv::Mat& img, cv::Mat& out) {
     return true;
 }
 
-void hog_stop(hoginfo_t *phg) {
+static void dlib_stop(hoginfo_t *phg) {
     delete phg;
 }
+
+// entry point looked up by hogload.cc
+extern "C" const hogapi_t deepseg_hog_api = { dlib_init, dlib_faces, dlib_stop };
@@ -11,4 +11,15 @@ hoginfo_t *hog_init(int debug);
 bool hog_faces(hoginfo_t *phg, cv::Mat& img, cv::Mat& out);
 void hog_stop(hoginfo_t *phg);
 
+// dlib (and its BLAS/LAPACK/X11 dependencies) lives in a plugin, loaded by
+// the first hog_init() (hogload.cc), so TFLite only startup never maps it
+#define HOG_PLUGIN	"libdeepseg-hog.so"
+#define HOG_SYMBOL	"deepseg_hog_api"
+
+typedef struct {
+	hoginfo_t *(*init)(int debug);
+	bool (*faces)(hoginfo_t *phg, cv::Mat& img, cv::Mat& out);
+	void (*stop)(hoginfo_t *phg);
+} hogapi_t;
+
 #endif // _DLIBHOG_H_
@@ -0,0 +1,396 @@
+// GStreamer video filter: person segmentation & background replacement
+// in place on raw I420/NV12/BGR buffers, with inference running
+// asynchronously on the newest frame (as deepseg's main loop does)
+//
+// gst-launch-1.0 v4l2src ! videoconvert ! deepseg background=beach.jpg ! videoconvert ! autovideosink
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <string>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "segment.h"
+#include "blend.h"
+
+#define DEEPSEG_MODEL "models/segm_full_v679.tflite"
+
+// element output
+#define OUTPUT_COMPOSITE	0	// frame over background
+#define OUTPUT_MASK			1	// person mask as greyscale frame
+
+// C++ state, kept out of the (C allocated) GObject instance
+typedef struct {
+	std::string model;
+	std::string back;
+	int threads;
+	int setthreads;		// thread change for the inference thread, or 0
+	int output;
+	GstVideoFormat fmt;
+	int w, h;
+	seginfo_t *pseg;
+	cv::Mat bg;			// background BGR
+	cv::Mat bgyuv;		// background I420 planes
+	// inference thread: latest frame in, latest masks out
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool pending;		// frame waiting for inference
+	cv::Mat frame;		// BGR input for inference
+	cv::Mat mask;		// full size CV_32FC1
+	cv::Mat cmask;		// half size, for 4:2:0 chroma
+} dsstate_t;
+
+typedef struct {
+	GstVideoFilter parent;
+	dsstate_t *st;
+} GstDeepseg;
+
+typedef struct {
+	GstVideoFilterClass parent_class;
+} GstDeepsegClass;
+
+#define GST_TYPE_DEEPSEG (gst_deepseg_get_type())
+#define GST_DEEPSEG(obj) ((GstDeepseg *)(obj))
+GType gst_deepseg_get_type(void);
+G_DEFINE_TYPE(GstDeepseg, gst_deepseg, GST_TYPE_VIDEO_FILTER);
+
+GST_DEBUG_CATEGORY_STATIC(gst_deepseg_debug);
+#define GST_CAT_DEFAULT gst_deepseg_debug
+
+enum {
+	PROP_0,
+	PROP_MODEL,
+	PROP_BACKGROUND,
+	PROP_THREADS,
+	PROP_OUTPUT,
+};
+
+#define DEEPSEG_CAPS GST_VIDEO_CAPS_MAKE("{ I420, NV12, BGR }")
+
+static void *infer_thread(void *arg) {
+	dsstate_t *st = (dsstate_t *)arg;
+	cv::Mat frame;
+	pthread_mutex_lock(&st->lock);
+	while (st->running) {
+		if (!st->pending) {
+			pthread_cond_wait(&st->cond, &st->lock);
+			continue;
+		}
+		// take the frame, infer without holding the lock
+		frame = st->frame;
+		st->frame = cv::Mat();
+		int threads = st->setthreads;
+		st->setthreads = 0;
+		pthread_mutex_unlock(&st->lock);
+		if (threads)
+			seg_set_threads(st->pseg, threads);
+		cv::Mat mask = cv::Mat::zeros(st->h, st->w, CV_32FC1), cmask;
+		bool ok = seg_prepare(st->pseg, frame) && seg_infer(st->pseg) && seg_mask(st->pseg, mask);
+		if (ok && st->fmt!=GST_VIDEO_FORMAT_BGR)
+			cv::resize(mask,cmask,cv::Size(st->w/2,st->h/2),0,0,cv::INTER_AREA);
+		pthread_mutex_lock(&st->lock);
+		st->pending = false;
+		if (ok) {
+			// fresh Mats each time, so the streaming thread can keep using the last ones
+			st->mask = mask;
+			st->cmask = cmask;
+		} else {
+			GST_WARNING("segmentation failed");
+		}
+	}
+	pthread_mutex_unlock(&st->lock);
+	return NULL;
+}
+
+static void deepseg_stop_pipeline(dsstate_t *st) {
+	if (st->pseg==NULL)
+		return;
+	pthread_mutex_lock(&st->lock);
+	st->running = false;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+	pthread_join(st->tid, NULL);
+	seg_stop(st->pseg);
+	st->pseg = NULL;
+}
+
+// (re)load background, into new Mats as frames may still use the old ones
+static void deepseg_load_background(dsstate_t *st) {
+	cv::Mat img, bg, bgyuv;
+	if (!st->back.empty()) {
+		img = cv::imread(st->back);
+		if (img.empty())
+			GST_WARNING("could not load background %s, defaulting to green", st->back.c_str());
+	}
+	if (img.empty())
+		img = cv::Mat(st->h,st->w,CV_8UC3,cv::Scalar(0,255,0));
+	cv::resize(img,bg,cv::Size(st->w,st->h));
+	cv::cvtColor(bg,bgyuv,CV_BGR2YUV_I420);
+	pthread_mutex_lock(&st->lock);
+	st->bg = bg;
+	st->bgyuv = bgyuv;
+	pthread_mutex_unlock(&st->lock);
+}
+
+static gboolean gst_deepseg_set_info(GstVideoFilter *filter, GstCaps *incaps, GstVideoInfo *in_info,
+	GstCaps *outcaps, GstVideoInfo *out_info) {
+	dsstate_t *st = GST_DEEPSEG(filter)->st;
+	deepseg_stop_pipeline(st);
+	st->fmt = GST_VIDEO_INFO_FORMAT(in_info);
+	st->w = GST_VIDEO_INFO_WIDTH(in_info);
+	st->h = GST_VIDEO_INFO_HEIGHT(in_info);
+	if ((st->w|st->h)&1) {
+		GST_ELEMENT_ERROR(filter, STREAM, FORMAT, ("odd frame size %dx%d not supported", st->w, st->h), (NULL));
+		return FALSE;
+	}
+	st->pseg = seg_init(st->model.c_str(), false, st->w, st->h, st->threads, 0);
+	if (st->pseg==NULL) {
+		GST_ELEMENT_ERROR(filter, RESOURCE, NOT_FOUND, ("could not load model %s", st->model.c_str()), (NULL));
+		return FALSE;
+	}
+	GST_INFO_OBJECT(filter, "pipeline: %s", seg_chain(st->pseg));
+	deepseg_load_background(st);
+	st->mask = cv::Mat::zeros(st->h, st->w, CV_32FC1);
+	st->cmask = cv::Mat::zeros(st->h/2, st->w/2, CV_32FC1);
+	st->pending = false;
+	st->setthreads = 0;
+	st->running = true;
+	if (pthread_create(&st->tid, NULL, infer_thread, st)) {
+		seg_stop(st->pseg);
+		st->pseg = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// blend one 8-bit plane with the background in place: step is the byte
+// distance between samples (2 for NV12's interleaved chroma)
+static void blend_plane(uint8_t *dst, int stride, int step, const cv::Mat& bg, const cv::Mat& mask) {
+	for (int y=0; y<mask.rows; y++) {
+		uint8_t *d = dst + y*stride;
+		const uint8_t *b = bg.ptr<uint8_t>(y);
+		const float *m = mask.ptr<float>(y);
+		for (int x=0; x<mask.cols; x++, d+=step)
+			*d = (uint8_t)( (float)(*d)*m[x] + (float)b[x]*(1.0f-m[x]) );
+	}
+}
+
+// write mask as luma, with neutral chroma
+static void mask_plane(uint8_t *dst, int stride, const cv::Mat& mask) {
+	for (int y=0; y<mask.rows; y++) {
+		uint8_t *d = dst + y*stride;
+		const float *m = mask.ptr<float>(y);
+		for (int x=0; x<mask.cols; x++)
+			d[x] = (uint8_t)(m[x]*255.0f);
+	}
+}
+
+static GstFlowReturn gst_deepseg_transform_frame_ip(GstVideoFilter *filter, GstVideoFrame *frame) {
+	dsstate_t *st = GST_DEEPSEG(filter)->st;
+	int w = st->w, h = st->h;
+	uint8_t *p0 = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+	int s0 = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+	cv::Mat bgr;
+	if (st->fmt==GST_VIDEO_FORMAT_BGR)
+		bgr = cv::Mat(h, w, CV_8UC3, p0, s0);
+
+	// hand the newest frame to an idle inference thread, take the latest mask
+	cv::Mat mask, cmask, bg, bgyuv;
+	pthread_mutex_lock(&st->lock);
+	if (!st->pending) {
+		if (st->fmt==GST_VIDEO_FORMAT_BGR) {
+			bgr.copyTo(st->frame);
+		} else {
+			// gather planes into OpenCV's packed 4:2:0 layout for conversion
+			cv::Mat yuv(h*3/2, w, CV_8UC1);
+			for (int y=0; y<h; y++)
+				memcpy(yuv.ptr(y), p0 + y*s0, w);
+			if (st->fmt==GST_VIDEO_FORMAT_I420) {
+				uint8_t *u = yuv.ptr(h), *v = u + (w/2)*(h/2);
+				for (int y=0; y<h/2; y++) {
+					memcpy(u + y*(w/2), (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 1) + y*GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1), w/2);
+					memcpy(v + y*(w/2), (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 2) + y*GST_VIDEO_FRAME_PLANE_STRIDE(frame, 2), w/2);
+				}
+				cv::cvtColor(yuv,st->frame,CV_YUV2BGR_I420);
+			} else {
+				for (int y=0; y<h/2; y++)
+					memcpy(yuv.ptr(h+y), (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 1) + y*GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1), w);
+				cv::cvtColor(yuv,st->frame,CV_YUV2BGR_NV12);
+			}
+		}
+		st->pending = true;
+		pthread_cond_signal(&st->cond);
+	}
+	mask = st->mask;
+	cmask = st->cmask;
+	bg = st->bg;
+	bgyuv = st->bgyuv;
+	pthread_mutex_unlock(&st->lock);
+
+	// composite (or write the mask) in place
+	if (st->fmt==GST_VIDEO_FORMAT_BGR) {
+		if (st->output==OUTPUT_MASK) {
+			cv::Mat m8;
+			mask.convertTo(m8, CV_8U, 255.0);
+			cv::cvtColor(m8, bgr, CV_GRAY2BGR);
+		} else {
+			blend_frame(bgr, bg, mask, bgr);
+		}
+		return GST_FLOW_OK;
+	}
+	int cw = w/2, ch = h/2;
+	cv::Mat by = bgyuv.rowRange(0, h);
+	cv::Mat bu(ch, cw, CV_8UC1, bgyuv.ptr(h));
+	cv::Mat bv(ch, cw, CV_8UC1, bgyuv.ptr(h) + cw*ch);
+	uint8_t *p1 = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 1);
+	int s1 = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1);
+	if (st->output==OUTPUT_MASK) {
+		mask_plane(p0, s0, mask);
+		if (st->fmt==GST_VIDEO_FORMAT_I420) {
+			for (int y=0; y<ch; y++) {
+				memset(p1 + y*s1, 128, cw);
+				memset((uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 2) + y*GST_VIDEO_FRAME_PLANE_STRIDE(frame, 2), 128, cw);
+			}
+		} else {
+			for (int y=0; y<ch; y++)
+				memset(p1 + y*s1, 128, w);
+		}
+		return GST_FLOW_OK;
+	}
+	blend_plane(p0, s0, 1, by, mask);
+	if (st->fmt==GST_VIDEO_FORMAT_I420) {
+		blend_plane(p1, s1, 1, bu, cmask);
+		blend_plane((uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 2), GST_VIDEO_FRAME_PLANE_STRIDE(frame, 2), 1, bv, cmask);
+	} else {
+		blend_plane(p1, s1, 2, bu, cmask);
+		blend_plane(p1+1, s1, 2, bv, cmask);
+	}
+	return GST_FLOW_OK;
+}
+
+static gboolean gst_deepseg_stop(GstBaseTransform *trans) {
+	deepseg_stop_pipeline(GST_DEEPSEG(trans)->st);
+	return TRUE;
+}
+
+static void gst_deepseg_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+	dsstate_t *st = GST_DEEPSEG(object)->st;
+	switch (prop_id) {
+	case PROP_MODEL:
+		st->model = g_value_get_string(value) ? g_value_get_string(value) : DEEPSEG_MODEL;
+		break;
+	case PROP_BACKGROUND:
+		st->back = g_value_get_string(value) ? g_value_get_string(value) : "";
+		if (st->pseg!=NULL)
+			deepseg_load_background(st);
+		break;
+	case PROP_THREADS:
+		st->threads = g_value_get_int(value);
+		pthread_mutex_lock(&st->lock);
+		st->setthreads = st->threads;
+		pthread_mutex_unlock(&st->lock);
+		break;
+	case PROP_OUTPUT:
+		st->output = g_strcmp0(g_value_get_string(value), "mask")==0 ? OUTPUT_MASK : OUTPUT_COMPOSITE;
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_deepseg_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+	dsstate_t *st = GST_DEEPSEG(object)->st;
+	switch (prop_id) {
+	case PROP_MODEL:
+		g_value_set_string(value, st->model.c_str());
+		break;
+	case PROP_BACKGROUND:
+		g_value_set_string(value, st->back.c_str());
+		break;
+	case PROP_THREADS:
+		g_value_set_int(value, st->threads);
+		break;
+	case PROP_OUTPUT:
+		g_value_set_string(value, st->output==OUTPUT_MASK ? "mask" : "composite");
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_deepseg_finalize(GObject *object) {
+	dsstate_t *st = GST_DEEPSEG(object)->st;
+	deepseg_stop_pipeline(st);
+	pthread_mutex_destroy(&st->lock);
+	pthread_cond_destroy(&st->cond);
+	delete st;
+	G_OBJECT_CLASS(gst_deepseg_parent_class)->finalize(object);
+}
+
+static void gst_deepseg_class_init(GstDeepsegClass *klass) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS(klass);
+	GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+	gobject_class->set_property = gst_deepseg_set_property;
+	gobject_class->get_property = gst_deepseg_get_property;
+	gobject_class->finalize = gst_deepseg_finalize;
+	g_object_class_install_property(gobject_class, PROP_MODEL,
+		g_param_spec_string("model", "Model", "TFLite segmentation model", DEEPSEG_MODEL,
+			(GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+	g_object_class_install_property(gobject_class, PROP_BACKGROUND,
+		g_param_spec_string("background", "Background", "Background image (default green)", "",
+			(GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+	g_object_class_install_property(gobject_class, PROP_THREADS,
+		g_param_spec_int("threads", "Threads", "TFLite threads (0 for default)", 0, 64, 0,
+			(GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+	g_object_class_install_property(gobject_class, PROP_OUTPUT,
+		g_param_spec_string("output", "Output", "composite or mask", "composite",
+			(GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+	gst_element_class_set_static_metadata(element_class, "Deepseg", "Filter/Effect/Video",
+		"Person segmentation with background replacement", "deepseg <https://github.com/floe/deepseg>");
+	GstCaps *caps = gst_caps_from_string(DEEPSEG_CAPS);
+	gst_element_class_add_pad_template(element_class, gst_pad_template_new("sink", GST_PAD_SINK, GST_PAD_ALWAYS, caps));
+	gst_element_class_add_pad_template(element_class, gst_pad_template_new("src", GST_PAD_SRC, GST_PAD_ALWAYS, caps));
+	gst_caps_unref(caps);
+
+	trans_class->stop = gst_deepseg_stop;
+	filter_class->set_info = gst_deepseg_set_info;
+	filter_class->transform_frame_ip = gst_deepseg_transform_frame_ip;
+}
+
+static void gst_deepseg_init(GstDeepseg *ds) {
+	dsstate_t *st = new dsstate_t;
+	st->model = DEEPSEG_MODEL;
+	st->threads = 0;
+	st->output = OUTPUT_COMPOSITE;
+	st->pseg = NULL;
+	st->w = st->h = 0;
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	ds->st = st;
+	gst_base_transform_set_in_place(GST_BASE_TRANSFORM(ds), TRUE);
+}
+
+static gboolean plugin_init(GstPlugin *plugin) {
+	GST_DEBUG_CATEGORY_INIT(gst_deepseg_debug, "deepseg", 0, "deepseg segmentation filter");
+	return gst_element_register(plugin, "deepseg", GST_RANK_NONE, GST_TYPE_DEEPSEG);
+}
+
+#define PACKAGE "deepseg"
+// Apache-2.0 is not in GStreamer's license list, which would refuse to load
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR, GST_VERSION_MINOR, deepseg,
+	"Person segmentation & background replacement", plugin_init,
+	"0.2.1", "unknown", "deepseg", "https://github.com/floe/deepseg")
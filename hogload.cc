@@ -0,0 +1,74 @@
+// Loads the dlib HOG face detector plugin (dlibhog.cc) on first use
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "dlibhog.h"
+
+static pthread_mutex_t hog_lock = PTHREAD_MUTEX_INITIALIZER;
+static const hogapi_t *hog_api = NULL;
+
+// directory part of path, including the trailing '/'
+static std::string dir_of(const char *path) {
+	const char *slash = strrchr(path, '/');
+	return slash ? std::string(path, slash-path+1) : std::string();
+}
+
+// beside this module (libdeepseg.so etc.), beside the executable, then the
+// usual library search path
+static const hogapi_t *hog_load(int debug) {
+	std::vector<std::string> paths;
+	Dl_info self;
+	if (dladdr((void *)hog_load, &self) && self.dli_fname && strchr(self.dli_fname, '/'))
+		paths.push_back(dir_of(self.dli_fname) + HOG_PLUGIN);
+	char exe[PATH_MAX];
+	ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe)-1);
+	if (n > 0) {
+		exe[n] = 0;
+		paths.push_back(dir_of(exe) + HOG_PLUGIN);
+	}
+	paths.push_back(HOG_PLUGIN);
+	for (auto& path : paths) {
+		void *lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (!lib) {
+			if (debug)
+				printf("hog: %s\n", dlerror());
+			continue;
+		}
+		const hogapi_t *api = (const hogapi_t *)dlsym(lib, HOG_SYMBOL);
+		if (api) {
+			if (debug)
+				printf("hog: loaded %s\n", path.c_str());
+			return api;
+		}
+		dlclose(lib);
+	}
+	fprintf(stderr, "Error: could not load %s (make %s)\n", HOG_PLUGIN, HOG_PLUGIN);
+	return NULL;
+}
+
+hoginfo_t *hog_init(int debug) {
+	pthread_mutex_lock(&hog_lock);
+	if (!hog_api)
+		hog_api = hog_load(debug);
+	const hogapi_t *api = hog_api;
+	pthread_mutex_unlock(&hog_lock);
+	return api ? api->init(debug) : NULL;
+}
+
+// only reachable with a hoginfo_t from a successful hog_init()
+bool hog_faces(hoginfo_t *phg, cv::Mat& img, cv::Mat& out) {
+	return hog_api->faces(phg, img, out);
+}
+
+void hog_stop(hoginfo_t *phg) {
+	hog_api->stop(phg);
+}
@@ -3,29 +3,662 @@
 #include <tensorflow/lite/interpreter.h>
 #include <tensorflow/lite/model.h>
 #include <tensorflow/lite/kernels/register.h>
+#include <tensorflow/lite/schema/schema_generated.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "inference.h"
 #include "transpose_conv_bias.h"
+#include "residency.h"
+#include "aot.h"
 
 using namespace tflite;
 
 #define ASSERT_OR_NULL(x) { if (!(x)) return NULL; }
 
+// recurrent state: an output fed back as an input of the next frame, by
+// swapping two buffers the tensors point at rather than copying
+typedef struct {
+	int in, out;	// tensor indices
+	void *buf[2];	// [0] read by the input, [1] written by the output
+	size_t bytes;
+} tfstate_t;
+
 struct _tfinfo_t {
+	flatbuffers::DetachedBuffer optbuf;	// rewritten model, outlives the model
 	std::unique_ptr<tflite::FlatBufferModel> model;
 	std::unique_ptr<Interpreter> interpreter;
+	// ahead-of-time compiled model (tfaot.py) instead of the interpreter
+	const aotmodel_t *aot;
+	float *arena;
+	std::unique_ptr<CpuBackendContext> ctx;
+	float scale, offset;	// input normalisation left to the caller
+	int in, out;			// image input & mask output tensors
+	std::vector<tfstate_t> state;
 	int debug;
 };
 
-tfinfo_t *tf_init(const char *modelname, int threads, int debug) {
+// Load-time graph rewrites on the unpacked model (flatbuffers object API):
+// each pass edits subgraph 0 in place, the result is repacked and the
+// interpreter built from that. Savings are reported per model.
+typedef struct {
+	int consts, acts, biases, dead;
+	bool norm, pruned;
+} tfsaved_t;
+
+static BuiltinOperator op_code(const ModelT *m, const OperatorT *op) {
+	return m->operator_codes[op->opcode_index]->builtin_code;
+}
+
+static bool op_custom(const ModelT *m, const OperatorT *op, const char *name) {
+	return op_code(m, op)==BuiltinOperator_CUSTOM && m->operator_codes[op->opcode_index]->custom_code==name;
+}
+
+static uint32_t op_index(ModelT *m, BuiltinOperator code) {
+	for (size_t c = 0; c < m->operator_codes.size(); c++)
+		if (m->operator_codes[c]->builtin_code==code)
+			return c;
+	OperatorCodeT *oc = new OperatorCodeT;
+	oc->builtin_code = code;
+	oc->version = 1;
+	m->operator_codes.emplace_back(oc);
+	return m->operator_codes.size()-1;
+}
+
+// fused activation of ops that have one, NULL otherwise
+static ActivationFunctionType *op_act(const ModelT *m, OperatorT *op) {
+	BuiltinOptionsUnion& o = op->builtin_options;
+	switch (op_code(m, op)) {
+	case BuiltinOperator_CONV_2D:
+		return o.AsConv2DOptions() ? &o.AsConv2DOptions()->fused_activation_function : NULL;
+	case BuiltinOperator_DEPTHWISE_CONV_2D:
+		return o.AsDepthwiseConv2DOptions() ? &o.AsDepthwiseConv2DOptions()->fused_activation_function : NULL;
+	case BuiltinOperator_FULLY_CONNECTED:
+		return o.AsFullyConnectedOptions() ? &o.AsFullyConnectedOptions()->fused_activation_function : NULL;
+	case BuiltinOperator_ADD:
+		return o.AsAddOptions() ? &o.AsAddOptions()->fused_activation_function : NULL;
+	case BuiltinOperator_MUL:
+		return o.AsMulOptions() ? &o.AsMulOptions()->fused_activation_function : NULL;
+	case BuiltinOperator_AVERAGE_POOL_2D:
+	case BuiltinOperator_MAX_POOL_2D:
+		return o.AsPool2DOptions() ? &o.AsPool2DOptions()->fused_activation_function : NULL;
+	default:
+		return NULL;
+	}
+}
+
+// constant data of tensor t, or NULL
+static std::vector<uint8_t> *tensor_data(ModelT *m, SubGraphT *g, int t) {
+	if (t < 0)
+		return NULL;
+	std::vector<uint8_t>& d = m->buffers[g->tensors[t]->buffer]->data;
+	return d.empty() ? NULL : &d;
+}
+
+// give tensor t a buffer of its own (buffers may be shared) with new contents
+static void tensor_set(ModelT *m, SubGraphT *g, int t, const void *data, size_t bytes) {
+	BufferT *b = new BufferT;
+	b->data.assign((const uint8_t *)data, (const uint8_t *)data + bytes);
+	g->tensors[t]->buffer = m->buffers.size();
+	m->buffers.emplace_back(b);
+}
+
+static int tensor_add(ModelT *m, SubGraphT *g, const std::string& name, TensorType type,
+	const std::vector<int32_t>& shape, const void *data, size_t bytes) {
+	TensorT *t = new TensorT;
+	t->name = name;
+	t->type = type;
+	t->shape = shape;
+	t->buffer = 0;	// the empty sentinel buffer
+	g->tensors.emplace_back(t);
+	if (data)
+		tensor_set(m, g, g->tensors.size()-1, data, bytes);
+	return g->tensors.size()-1;
+}
+
+static int consumers(SubGraphT *g, int t) {
+	int n = std::count(g->outputs.begin(), g->outputs.end(), t);
+	for (auto& op : g->operators)
+		n += std::count(op->inputs.begin(), op->inputs.end(), t);
+	return n;
+}
+
+static OperatorT *producer(SubGraphT *g, int t) {
+	for (auto& op : g->operators)
+		if (std::find(op->outputs.begin(), op->outputs.end(), t) != op->outputs.end())
+			return op.get();
+	return NULL;
+}
+
+static void drop_ops(SubGraphT *g, const std::vector<OperatorT *>& dead) {
+	g->operators.erase(std::remove_if(g->operators.begin(), g->operators.end(),
+		[&dead](const std::unique_ptr<OperatorT>& op) {
+			return std::find(dead.begin(), dead.end(), op.get()) != dead.end();
+		}), g->operators.end());
+}
+
+static float half_to_float(uint16_t h) {
+	int e = (h >> 10) & 0x1f, f = h & 0x3ff;
+	float v = (e==0) ? ldexpf((float)f, -24) : (e==31) ? (f ? NAN : INFINITY) : ldexpf((float)(f | 0x400), e-25);
+	return (h & 0x8000) ? -v : v;
+}
+
+// fp16 weights: dequantize once here rather than keeping DEQUANTIZE nodes
+static int fold_constants(ModelT *m, SubGraphT *g) {
+	std::vector<OperatorT *> dead;
+	for (auto& op : g->operators) {
+		std::vector<uint8_t> *d = tensor_data(m, g, op->inputs[0]);
+		if (op_code(m, op.get())!=BuiltinOperator_DEQUANTIZE || !d ||
+			g->tensors[op->inputs[0]]->type!=TensorType_FLOAT16)
+			continue;
+		std::vector<float> v(d->size()/2);
+		for (size_t i = 0; i < v.size(); i++)
+			v[i] = half_to_float((uint16_t)((*d)[2*i] | (*d)[2*i+1] << 8));
+		tensor_set(m, g, op->outputs[0], v.data(), v.size()*sizeof(float));
+		dead.push_back(op.get());
+	}
+	drop_ops(g, dead);
+	return dead.size();
+}
+
+// standalone RELU/RELU6 into the fused activation of the op producing its input
+static int fuse_activations(ModelT *m, SubGraphT *g) {
+	std::vector<OperatorT *> dead;
+	for (auto& op : g->operators) {
+		ActivationFunctionType act;
+		switch (op_code(m, op.get())) {
+		case BuiltinOperator_RELU: act = ActivationFunctionType_RELU; break;
+		case BuiltinOperator_RELU6: act = ActivationFunctionType_RELU6; break;
+		case BuiltinOperator_RELU_N1_TO_1: act = ActivationFunctionType_RELU_N1_TO_1; break;
+		default: continue;
+		}
+		int t = op->inputs[0];
+		OperatorT *p = producer(g, t);
+		ActivationFunctionType *pact = p ? op_act(m, p) : NULL;
+		if (!pact || *pact!=ActivationFunctionType_NONE || consumers(g, t)!=1)
+			continue;
+		*pact = act;
+		p->outputs[0] = op->outputs[0];
+		dead.push_back(op.get());
+	}
+	drop_ops(g, dead);
+	return dead.size();
+}
+
+// shape [C] or [1,..,1,C], ie. one value per channel of a NHWC tensor
+static bool per_channel(const std::vector<int32_t>& shape, int32_t c) {
+	if (shape.empty() || shape.back()!=c)
+		return false;
+	for (size_t i = 0; i+1 < shape.size(); i++)
+		if (shape[i]!=1)
+			return false;
+	return true;
+}
+
+// per-channel constant ADD after a convolution (incl. the custom
+// transpose-conv) into that convolution's bias
+static int fold_biases(ModelT *m, SubGraphT *g) {
+	std::vector<OperatorT *> dead;
+	for (auto& op : g->operators) {
+		if (op_code(m, op.get())!=BuiltinOperator_ADD || op->inputs.size()!=2)
+			continue;
+		int x = op->inputs[0], k = op->inputs[1];
+		if (tensor_data(m, g, x))
+			std::swap(x, k);
+		std::vector<uint8_t> *kd = tensor_data(m, g, k);
+		OperatorT *p = producer(g, x);
+		if (!kd || !p || g->tensors[k]->type!=TensorType_FLOAT32 || consumers(g, x)!=1)
+			continue;
+		bool tconv = op_custom(m, p, "Convolution2DTransposeBias");
+		if (!tconv && op_code(m, p)!=BuiltinOperator_CONV_2D && op_code(m, p)!=BuiltinOperator_DEPTHWISE_CONV_2D)
+			continue;
+		// activation on the producer would apply before the add; the custom op has none
+		ActivationFunctionType *pact = op_act(m, p), *aact = op_act(m, op.get());
+		ActivationFunctionType act = aact ? *aact : ActivationFunctionType_NONE;
+		if ((pact && *pact!=ActivationFunctionType_NONE) || (tconv && act!=ActivationFunctionType_NONE))
+			continue;
+		// the addend must broadcast along the output channels only, and the
+		// bias (rewritten in place) must not be shared with another op
+		const std::vector<int32_t>& os = g->tensors[p->outputs[0]]->shape;
+		if (os.empty() || !per_channel(g->tensors[k]->shape, os.back()))
+			continue;
+		std::vector<uint8_t> *bd = p->inputs.size() > 2 ? tensor_data(m, g, p->inputs[2]) : NULL;
+		if (!bd || bd->size()!=kd->size() || consumers(g, p->inputs[2])!=1)
+			continue;
+		std::vector<float> b(bd->size()/sizeof(float));
+		const float *kv = (const float *)kd->data();
+		memcpy(b.data(), bd->data(), bd->size());
+		for (size_t c = 0; c < b.size(); c++)
+			b[c] += kv[c];
+		tensor_set(m, g, p->inputs[2], b.data(), b.size()*sizeof(float));
+		if (pact)
+			*pact = act;
+		p->outputs[0] = op->outputs[0];
+		dead.push_back(op.get());
+	}
+	drop_ops(g, dead);
+	return dead.size();
+}
+
+// input*scale+offset into the first convolution: w' = w*scale, b' = b +
+// offset*sum(w), so raw pixel values can be fed. Implicit zero padding of
+// the normalised input becomes an explicit PADV2 with the raw equivalent.
+static bool fold_normalisation(ModelT *m, SubGraphT *g, float scale, float offset) {
+	int in = g->inputs[0];
+	OperatorT *c = NULL;
+	for (auto& op : g->operators)
+		if (std::find(op->inputs.begin(), op->inputs.end(), in) != op->inputs.end())
+			c = op.get();
+	if (!c || op_code(m, c)!=BuiltinOperator_CONV_2D || c->inputs[0]!=in || consumers(g, in)!=1 ||
+		c->inputs.size() < 3 || !c->builtin_options.AsConv2DOptions())
+		return false;
+	std::vector<uint8_t> *wd = tensor_data(m, g, c->inputs[1]), *bd = tensor_data(m, g, c->inputs[2]);
+	if (!wd || !bd || g->tensors[c->inputs[1]]->type!=TensorType_FLOAT32 ||
+		g->tensors[c->inputs[2]]->type!=TensorType_FLOAT32)
+		return false;
+	Conv2DOptionsT *o = c->builtin_options.AsConv2DOptions();
+	const std::vector<int32_t>& is = g->tensors[in]->shape;
+	const std::vector<int32_t>& ws = g->tensors[c->inputs[1]]->shape;
+	const std::vector<int32_t>& os = g->tensors[c->outputs[0]]->shape;
+	if (is.size()!=4 || ws.size()!=4 || os.size()!=4)
+		return false;
+
+	std::vector<float> w(wd->size()/sizeof(float)), b(bd->size()/sizeof(float));
+	memcpy(w.data(), wd->data(), wd->size());
+	memcpy(b.data(), bd->data(), bd->size());
+	size_t per = w.size()/b.size();
+	for (size_t oc = 0; oc < b.size(); oc++) {
+		double sum = 0;
+		for (size_t i = 0; i < per; i++) {
+			sum += w[oc*per+i];
+			w[oc*per+i] *= scale;
+		}
+		b[oc] += (float)(offset*sum);
+	}
+	tensor_set(m, g, c->inputs[1], w.data(), w.size()*sizeof(float));
+	tensor_set(m, g, c->inputs[2], b.data(), b.size()*sizeof(float));
+
+	int ph = 0, pw = 0;
+	if (o->padding==Padding_SAME) {
+		ph = std::max(0, (os[1]-1)*o->stride_h + (ws[1]-1)*o->dilation_h_factor + 1 - is[1]);
+		pw = std::max(0, (os[2]-1)*o->stride_w + (ws[2]-1)*o->dilation_w_factor + 1 - is[2]);
+	}
+	if (ph || pw) {
+		int32_t pads[8] = { 0, 0, ph/2, ph-ph/2, pw/2, pw-pw/2, 0, 0 };
+		float value = -offset/scale;
+		int padded = tensor_add(m, g, g->tensors[in]->name + "/padded", TensorType_FLOAT32,
+			{ is[0], is[1]+ph, is[2]+pw, is[3] }, NULL, 0);
+		OperatorT *pad = new OperatorT;
+		pad->opcode_index = op_index(m, BuiltinOperator_PADV2);
+		pad->inputs = { in, tensor_add(m, g, "paddings", TensorType_INT32, { 4, 2 }, pads, sizeof(pads)),
+			tensor_add(m, g, "pad_value", TensorType_FLOAT32, { 1 }, &value, sizeof(value)) };
+		pad->outputs = { padded };
+		pad->builtin_options.Set(PadV2OptionsT());
+		g->operators.emplace(g->operators.begin(), pad);
+		c->inputs[0] = padded;
+		o->padding = Padding_VALID;
+	}
+	return true;
+}
+
+// class logits -> logit[keep] - max(other logits), ahead of the upscaling
+// resizes, so those and the output decoder handle one channel instead of
+// all classes: the logits convolution is split in two (kept class, others),
+// followed by REDUCE_MAX over the others and a SUB
+static bool prune_classes(ModelT *m, SubGraphT *g, int keep) {
+	int t = g->outputs[0];
+	std::vector<int> resized;
+	OperatorT *p;
+	while ((p = producer(g, t)) && op_code(m, p)==BuiltinOperator_RESIZE_BILINEAR && consumers(g, t)==1) {
+		resized.push_back(t);
+		t = p->inputs[0];
+	}
+	if (!p || op_code(m, p)!=BuiltinOperator_CONV_2D || consumers(g, t)!=1 || p->inputs.size() < 3 ||
+		!p->builtin_options.AsConv2DOptions())
+		return false;
+	std::vector<uint8_t> *wd = tensor_data(m, g, p->inputs[1]), *bd = tensor_data(m, g, p->inputs[2]);
+	if (!wd || !bd || g->tensors[p->inputs[1]]->type!=TensorType_FLOAT32 ||
+		g->tensors[p->inputs[2]]->type!=TensorType_FLOAT32)
+		return false;
+	std::vector<int32_t> ws = g->tensors[p->inputs[1]]->shape, ls = g->tensors[t]->shape;
+	int n = bd->size()/sizeof(float);
+	if (keep < 0 || keep >= n || n < 3 || ws.size()!=4 || ls.size()!=4 || ls[3]!=n)
+		return false;
+
+	// split weights & biases by output channel
+	const float *w = (const float *)wd->data(), *b = (const float *)bd->data();
+	size_t per = wd->size()/sizeof(float)/n;
+	std::vector<float> wk(w + keep*per, w + (keep+1)*per), bk(1, b[keep]), wo, bo;
+	for (int c = 0; c < n; c++) {
+		if (c==keep)
+			continue;
+		wo.insert(wo.end(), w + c*per, w + (c+1)*per);
+		bo.push_back(b[c]);
+	}
+	std::string name = g->tensors[t]->name;
+	p->inputs[1] = tensor_add(m, g, name + "/keep_w", TensorType_FLOAT32, { 1, ws[1], ws[2], ws[3] },
+		wk.data(), wk.size()*sizeof(float));
+	p->inputs[2] = tensor_add(m, g, name + "/keep_b", TensorType_FLOAT32, { 1 }, bk.data(), sizeof(float));
+	g->tensors[t]->shape[3] = 1;
+
+	OperatorT *others = new OperatorT;
+	others->opcode_index = p->opcode_index;
+	others->inputs = { p->inputs[0],
+		tensor_add(m, g, name + "/others_w", TensorType_FLOAT32, { n-1, ws[1], ws[2], ws[3] },
+			wo.data(), wo.size()*sizeof(float)),
+		tensor_add(m, g, name + "/others_b", TensorType_FLOAT32, { n-1 }, bo.data(), bo.size()*sizeof(float)) };
+	others->outputs = { tensor_add(m, g, name + "/others", TensorType_FLOAT32, { ls[0], ls[1], ls[2], n-1 }, NULL, 0) };
+	Conv2DOptionsT co = *p->builtin_options.AsConv2DOptions();
+	others->builtin_options.Set(co);
+
+	int32_t axis = 3;
+	OperatorT *rmax = new OperatorT;
+	rmax->opcode_index = op_index(m, BuiltinOperator_REDUCE_MAX);
+	rmax->inputs = { others->outputs[0], tensor_add(m, g, name + "/axis", TensorType_INT32, { 1 }, &axis, sizeof(axis)) };
+	rmax->outputs = { tensor_add(m, g, name + "/others_max", TensorType_FLOAT32, { ls[0], ls[1], ls[2], 1 }, NULL, 0) };
+	ReducerOptionsT ro;
+	ro.keep_dims = true;
+	rmax->builtin_options.Set(ro);
+
+	OperatorT *sub = new OperatorT;
+	sub->opcode_index = op_index(m, BuiltinOperator_SUB);
+	sub->inputs = { t, rmax->outputs[0] };
+	sub->outputs = { tensor_add(m, g, name + "/margin", TensorType_FLOAT32, { ls[0], ls[1], ls[2], 1 }, NULL, 0) };
+	sub->builtin_options.Set(SubOptionsT());
+
+	// the resizes now scale the margin, one channel throughout (without
+	// any, the margin is the output)
+	if (resized.empty())
+		g->outputs[0] = sub->outputs[0];
+	else
+		producer(g, resized.back())->inputs[0] = sub->outputs[0];
+	for (int r : resized)
+		g->tensors[r]->shape[3] = 1;
+
+	size_t at = 0;
+	while (g->operators[at].get()!=p)
+		at++;
+	g->operators.emplace(g->operators.begin() + at+1, sub);
+	g->operators.emplace(g->operators.begin() + at+1, rmax);
+	g->operators.emplace(g->operators.begin() + at+1, others);
+	return true;
+}
+
+// only the first output is read (tf_get_buffer), drop the rest and every
+// op that no longer feeds it; recurrent models (more than one input) feed
+// outputs back, so they are left alone
+static int drop_dead(ModelT *m, SubGraphT *g) {
+	if (g->inputs.size()!=1)
+		return 0;
+	g->outputs.resize(1);
+	std::vector<bool> live(g->tensors.size(), false);
+	live[g->outputs[0]] = true;
+	std::vector<OperatorT *> dead;
+	for (auto op = g->operators.rbegin(); op != g->operators.rend(); ++op) {
+		bool used = false;
+		for (int t : (*op)->outputs)
+			used |= t >= 0 && live[t];
+		if (!used) {
+			dead.push_back(op->get());
+			continue;
+		}
+		for (int t : (*op)->inputs)
+			if (t >= 0)
+				live[t] = true;
+	}
+	drop_ops(g, dead);
+	return dead.size();
+}
+
+static size_t weight_bytes(ModelT *m) {
+	size_t n = 0;
+	for (auto& b : m->buffers)
+		n += b->data.size();
+	return n;
+}
+
+static void tf_optimize(ModelT *m, const tfopt_t *opt, const char *modelname, tfsaved_t *res) {
+	memset(res, 0, sizeof(*res));
+	if (m->subgraphs.size()!=1)
+		return;
+	SubGraphT *g = m->subgraphs[0].get();
+	size_t ops = g->operators.size(), wbytes = weight_bytes(m);
+	if (opt->flags & TFINFO_OPT_CONST)
+		res->consts = fold_constants(m, g);
+	if (opt->flags & TFINFO_OPT_FUSE) {
+		res->acts = fuse_activations(m, g);
+		res->biases = fold_biases(m, g);
+	}
+	if (opt->flags & TFINFO_OPT_NORM)
+		res->norm = fold_normalisation(m, g, opt->scale, opt->offset);
+	if (opt->flags & TFINFO_OPT_DEAD)
+		res->dead = drop_dead(m, g);
+	if (opt->flags & TFINFO_OPT_CLASS)
+		res->pruned = prune_classes(m, g, opt->keep);
+
+	// release buffers no remaining op or graph input/output refers to
+	std::vector<bool> used(m->buffers.size(), false);
+	used[0] = true;
+	for (auto& op : g->operators)
+		for (int t : op->inputs)
+			if (t >= 0)
+				used[g->tensors[t]->buffer] = true;
+	for (size_t b = 0; b < used.size(); b++)
+		if (!used[b])
+			std::vector<uint8_t>().swap(m->buffers[b]->data);
+
+	printf("optimise: %s: %zu -> %zu ops (%d constant, %d activation, %d bias folded, %d dead), "
+		"normalisation %s, weights %zuKB -> %zuKB", modelname, ops, g->operators.size(),
+		res->consts, res->acts, res->biases, res->dead, res->norm ? "folded" : "kept",
+		wbytes/1024, weight_bytes(m)/1024);
+	if (opt->flags & TFINFO_OPT_CLASS)
+		printf(", head %s", res->pruned ? "pruned to one class" : "kept");
+	printf("\n");
+}
+
+static const char *model_base(const char *path) {
+	const char *p = strrchr(path, '/');
+	return p ? p+1 : path;
+}
+
+// aot:<model file> selects the compiled in version of that model
+static tfinfo_t *tf_init_aot(tfinfo_t *ptf, const char *modelname, int threads) {
+#ifdef DEEPSEG_AOT
+	for (int m = 0; aot_models[m] && !ptf->aot; m++)
+		if (strcmp(model_base(aot_models[m]->source), model_base(modelname))==0)
+			ptf->aot = aot_models[m];
+#endif
+	if (!ptf->aot) {
+		fprintf(stderr, "Error: no ahead-of-time compiled model for %s (make deepseg-aot)\n", modelname);
+		return NULL;
+	}
+	ASSERT_OR_NULL(posix_memalign((void **)&ptf->arena, 64, ptf->aot->arena*sizeof(float)) == 0);
+	ptf->ctx.reset(new CpuBackendContext());
+	ptf->ctx->SetMaxNumThreads(threads);
+	if (ptf->debug)
+		printf("aot model %s: %d ops, arena %zuKB, weights %zuKB\n", ptf->aot->source, ptf->aot->ops,
+			ptf->aot->arena*sizeof(float)/1024, ptf->aot->wbytes/1024);
+
+	resident_region(ptf->arena, ptf->aot->arena*sizeof(float), true);
+	resident_region((void *)ptf->aot->weights, ptf->aot->wbytes, false);
+	return ptf;
+}
+
+// state pairing key: the name without its last "in"/"out" word
+// (state_in_1/state_out_1), else without a trailing 'i'/'o' (r1i/r1o)
+static std::string state_key(const char *name, bool input) {
+	std::string n = name ? name : "";
+	size_t colon = n.rfind(':');
+	if (colon!=std::string::npos)
+		n.resize(colon);
+	std::string tag = input ? "in" : "out";
+	for (size_t at = n.rfind(tag); at!=std::string::npos; at = at ? n.rfind(tag, at-1) : std::string::npos) {
+		size_t end = at + tag.size();
+		if ((at==0 || !isalpha(n[at-1])) && (end==n.size() || !isalpha(n[end])))
+			return n.erase(at, tag.size());
+	}
+	if (!n.empty() && n.back()==(input ? 'i' : 'o'))
+		n.pop_back();
+	return n;
+}
+
+static bool same_shape(TfLiteTensor *a, TfLiteTensor *b) {
+	if (a->type!=kTfLiteFloat32 || b->type!=kTfLiteFloat32 || a->dims->size!=b->dims->size)
+		return false;
+	for (int d = 0; d < a->dims->size; d++)
+		if (a->dims->data[d]!=b->dims->data[d])
+			return false;
+	return true;
+}
+
+// point the state tensors at their buffers (TF v2.4 has no custom tensor
+// allocations): arena tensor data pointers are only resolved again by
+// AllocateTensors(), which is not called after this on these static graphs,
+// so the kernels read and write the buffers directly
+static void state_bind(Interpreter *ip, const tfstate_t& st) {
+	ip->tensor(st.in)->data.raw = (char *)st.buf[0];
+	ip->tensor(st.out)->data.raw = (char *)st.buf[1];
+}
+
+// scalar parameter inputs of known models, by (part of) tensor name
+static const struct {
+	const char *name;
+	float value;
+} params[] = {
+	{ "downsample_ratio", 1.0f },	// RVM: internal branch scale, 1 => full input size
+};
+
+// set a known scalar parameter input, false if it is not one
+static bool set_param(TfLiteTensor *t) {
+	if (t->type!=kTfLiteFloat32 || t->bytes!=sizeof(float) || !t->name)
+		return false;
+	for (auto& p : params) {
+		if (strstr(t->name, p.name)) {
+			*(float *)t->data.raw = p.value;
+			return true;
+		}
+	}
+	return false;
+}
+
+// pair inputs after the first with outputs of the same shape, by name and
+// then in order; the mask is the narrowest output left (the alpha matte
+// for matting models, which also output the foreground)
+static bool find_state(tfinfo_t *ptf) {
+	Interpreter *ip = ptf->interpreter.get();
+	std::vector<int> ins(ip->inputs().begin()+1, ip->inputs().end()), outs = ip->outputs();
+	for (int byname = 1; byname >= 0; byname--) {
+		for (auto i = ins.begin(); i != ins.end(); ) {
+			auto o = outs.begin();
+			for (; o != outs.end(); ++o)
+				if (same_shape(ip->tensor(*i), ip->tensor(*o)) && (!byname ||
+					state_key(ip->tensor(*i)->name, true)==state_key(ip->tensor(*o)->name, false)))
+					break;
+			if (o==outs.end()) {
+				++i;
+				continue;
+			}
+			tfstate_t st = { *i, *o, { NULL, NULL }, ip->tensor(*i)->bytes };
+			ptf->state.push_back(st);
+			i = ins.erase(i);
+			outs.erase(o);
+		}
+	}
+	if (outs.empty())
+		return false;
+	ptf->out = outs[0];
+	for (int o : outs)
+		if (ip->tensor(o)->dims->data[ip->tensor(o)->dims->size-1] <
+			ip->tensor(ptf->out)->dims->data[ip->tensor(ptf->out)->dims->size-1])
+			ptf->out = o;
+
+	size_t total = 0;
+	for (auto& st : ptf->state) {
+		size_t len = (st.bytes + 63) & ~(size_t)63;
+		for (int b = 0; b < 2; b++)
+			if (posix_memalign(&st.buf[b], 64, len))
+				return false;
+		total += 2*len;
+	}
+	if (!ptf->state.empty()) {
+		tf_reset_state(ptf);
+		for (auto& st : ptf->state)
+			state_bind(ip, st);
+		for (auto& st : ptf->state)
+			for (int b = 0; b < 2; b++)
+				resident_region(st.buf[b], st.bytes, true);
+		printf("state: %zu recurrent tensors (%zuKB), fed back by buffer swap\n", ptf->state.size(), total/1024);
+	}
+	// other inputs must be parameters we know a value for
+	for (int i : ins) {
+		if (!set_param(ip->tensor(i))) {
+			fprintf(stderr, "Error: unknown model input '%s'\n", ip->tensor(i)->name ? ip->tensor(i)->name : "?");
+			return false;
+		}
+	}
+	return true;
+}
+
+// state tensors point at their own buffers, outside the arena
+static bool is_state(tfinfo_t *ptf, int t) {
+	for (auto& st : ptf->state)
+		if (st.in==t || st.out==t)
+			return true;
+	return false;
+}
+
+// address range of the tensors in one arena (kTfLiteArenaRw or
+// kTfLiteArenaRwPersistent): each is its own heap allocation, so spans are
+// only taken within one, never across the gap between them
+static void arena_span(tfinfo_t *ptf, TfLiteAllocationType type, char **plo, char **phi) {
+	char *lo = NULL, *hi = NULL;
+	for (size_t t = 0; t < ptf->interpreter->tensors_size(); t++) {
+		TfLiteTensor *tensor = ptf->interpreter->tensor(t);
+		if (tensor->data.raw == nullptr || tensor->allocation_type != type || is_state(ptf, t))
+			continue;
+		if (!lo || tensor->data.raw < lo) lo = tensor->data.raw;
+		if (tensor->data.raw + tensor->bytes > hi) hi = tensor->data.raw + tensor->bytes;
+	}
+	*plo = lo;
+	*phi = hi;
+}
+
+tfinfo_t *tf_init(const char *modelname, int threads, int debug, const tfopt_t *opt) {
 	// Allocate info block
 	tfinfo_t *ptf = new tfinfo_t;
 	ptf->debug = debug;
+	ptf->aot = NULL;
+	ptf->arena = NULL;
+	ptf->scale = opt ? opt->scale : 1.0;
+	ptf->offset = opt ? opt->offset : 0.0;
+	if (strncmp(modelname, "aot:", 4)==0)
+		return tf_init_aot(ptf, modelname+4, threads);
 
 	// Load model
 	ptf->model = tflite::FlatBufferModel::BuildFromFile(modelname);
 	ASSERT_OR_NULL(ptf->model != nullptr);
 
+	// rewrite the graph and reload it from memory
+	if (opt && opt->flags) {
+		std::unique_ptr<ModelT> m(ptf->model->GetModel()->UnPack());
+		tfsaved_t res;
+		tf_optimize(m.get(), opt, modelname, &res);
+		if (res.norm) {
+			ptf->scale = 1.0;
+			ptf->offset = 0.0;
+		}
+		flatbuffers::FlatBufferBuilder fbb;
+		FinishModelBuffer(fbb, Model::Pack(fbb, m.get()));
+		ptf->optbuf = fbb.Release();
+		ptf->model = tflite::FlatBufferModel::BuildFromBuffer((const char *)ptf->optbuf.data(), ptf->optbuf.size());
+		ASSERT_OR_NULL(ptf->model != nullptr);
+	}
+
 	// Build the interpreter
 	tflite::ops::builtin::BuiltinOpResolver resolver;
 	// custom op for Google Meet network
@@ -36,16 +669,39 @@ tfinfo_t *tf_init(const char *modelname, int threads, int debug) {
 
 	// Allocate tensor buffers.
 	ASSERT_OR_NULL(ptf->interpreter->AllocateTensors() == kTfLiteOk);
+	ptf->in = ptf->interpreter->inputs()[0];
+	ASSERT_OR_NULL(find_state(ptf));
 
 	// set interpreter params
 	ptf->interpreter->SetNumThreads(threads);
 	ptf->interpreter->SetAllowFp16PrecisionForFp32(true);
 
+	// residency mode: prefault (and lock) the tensor arenas and the weights
+	for (TfLiteAllocationType type : { kTfLiteArenaRw, kTfLiteArenaRwPersistent }) {
+		char *lo, *hi;
+		arena_span(ptf, type, &lo, &hi);
+		if (lo)
+			resident_region(lo, hi-lo, true);
+	}
+	const Allocation *weights = ptf->model->allocation();
+	if (weights)
+		resident_region((void *)weights->base(), weights->bytes(), false);
+
 	return ptf;
 }
 
 tfbuffer_t *tf_get_buffer(tfinfo_t *ptf, int which) {
-	int tnum = (0==which) ? ptf->interpreter->inputs()[0] : ptf->interpreter->outputs()[0];
+	if (ptf->aot) {
+		tfbuffer_t *pbuf = new tfbuffer_t;
+		pbuf->w = (0==which) ? ptf->aot->inw : ptf->aot->outw;
+		pbuf->h = (0==which) ? ptf->aot->inh : ptf->aot->outh;
+		pbuf->c = (0==which) ? ptf->aot->inc : ptf->aot->outc;
+		pbuf->data = ptf->arena + ((0==which) ? ptf->aot->inoff : ptf->aot->outoff);
+		pbuf->scale = (0==which) ? ptf->scale : 1.0;
+		pbuf->offset = (0==which) ? ptf->offset : 0.0;
+		return pbuf;
+	}
+	int tnum = (0==which) ? ptf->in : ptf->out;
 	TfLiteType t_type = ptf->interpreter->tensor(tnum)->type;
 	ASSERT_OR_NULL(t_type == kTfLiteFloat32);
 
@@ -59,12 +715,66 @@ tfbuffer_t *tf_get_buffer(tfinfo_t *ptf, int which) {
 	pbuf->c = dims->data[3];
 	pbuf->data = ptf->interpreter->typed_tensor<float>(tnum);
 	ASSERT_OR_NULL(pbuf->data != nullptr);
+	pbuf->scale = (0==which) ? ptf->scale : 1.0;
+	pbuf->offset = (0==which) ? ptf->offset : 0.0;
 	return pbuf;
 }
 
+void tf_memory(tfinfo_t *ptf, size_t *arena, size_t *weights) {
+	if (ptf->aot) {
+		*arena = ptf->aot->arena*sizeof(float);
+		*weights = 0;	// in the binary
+		return;
+	}
+	// each arena on its own, not the heap between them
+	*arena = 0;
+	for (TfLiteAllocationType type : { kTfLiteArenaRw, kTfLiteArenaRwPersistent }) {
+		char *lo, *hi;
+		arena_span(ptf, type, &lo, &hi);
+		*arena += hi-lo;
+	}
+	*weights = ptf->optbuf.size();
+}
+
 bool tf_infer(tfinfo_t *ptf) {
-	return (ptf->interpreter->Invoke() == kTfLiteOk);
+	if (ptf->aot)
+		return ptf->aot->invoke(ptf->arena, ptf->ctx.get());
+	if (ptf->interpreter->Invoke() != kTfLiteOk)
+		return false;
+	// this frame's state output is the next frame's state input
+	for (auto& st : ptf->state) {
+		std::swap(st.buf[0], st.buf[1]);
+		state_bind(ptf->interpreter.get(), st);
+	}
+	return true;
+}
+
+int tf_state_count(tfinfo_t *ptf) {
+	return ptf->state.size();
+}
+
+void tf_reset_state(tfinfo_t *ptf) {
+	for (auto& st : ptf->state)
+		memset(st.buf[0], 0, st.bytes);
+}
+
+void tf_set_threads(tfinfo_t *ptf, int threads) {
+	if (ptf->aot) {
+		ptf->ctx->SetMaxNumThreads(threads);
+		return;
+	}
+	ptf->interpreter->SetNumThreads(threads);
 }
 
 void tf_stop(tfinfo_t *ptf) {
+	// interpreter is released before the model it references, and the
+	// state buffers it points to
+	free(ptf->arena);
+	std::vector<tfstate_t> state;
+	state.swap(ptf->state);
+	delete ptf;
+	for (auto& st : state) {
+		free(st.buf[0]);
+		free(st.buf[1]);
+	}
 }
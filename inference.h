@@ -1,6 +1,7 @@
 #ifndef _INFERENCE_H_
 #define _INFERENCE_H_
 
+#include <stddef.h>
 
 // opaque type for callers
 struct _tfinfo_t;
@@ -10,13 +11,36 @@ typedef struct _tfinfo_t tfinfo_t;
 typedef struct {
 	int w, h, c;
 	float *data;
+	float scale, offset;	// input: caller stores pixel*scale+offset
 } tfbuffer_t;
 #define TFINFO_BUF_IN	0
 #define TFINFO_BUF_OUT	1
 
-tfinfo_t *tf_init(const char *modelname, int threads, int debug);
+// load-time graph rewrites (tfopt_t flags)
+#define TFINFO_OPT_CONST	0x01	// fold constant (fp16) dequantize ops
+#define TFINFO_OPT_FUSE		0x02	// fuse standalone activations & bias adds into convolutions
+#define TFINFO_OPT_NORM		0x04	// fold input normalisation into the first convolution
+#define TFINFO_OPT_DEAD		0x08	// drop outputs & ops not feeding the first output (single input models)
+#define TFINFO_OPT_ALL		0x0f
+#define TFINFO_OPT_CLASS	0x10	// collapse class logits to logit[keep] - max(others)
+
+typedef struct {
+	int flags;
+	float scale, offset;	// caller's input normalisation, see tfbuffer_t
+	int keep;				// class kept by TFINFO_OPT_CLASS
+} tfopt_t;
+
+tfinfo_t *tf_init(const char *modelname, int threads, int debug, const tfopt_t *opt);
 tfbuffer_t *tf_get_buffer(tfinfo_t *ptf, int which);
 bool tf_infer(tfinfo_t *ptf);
+void tf_set_threads(tfinfo_t *ptf, int threads);
+// recurrent models: further inputs are paired with outputs of the same
+// shape, fed back each frame by tf_infer() without copying
+int tf_state_count(tfinfo_t *ptf);
+void tf_reset_state(tfinfo_t *ptf);		// zero the state, eg. on a scene cut
+// tensor arena, and model bytes held in memory (rewritten models; weights
+// mapped from the .tflite file are not counted)
+void tf_memory(tfinfo_t *ptf, size_t *arena, size_t *weights);
 void tf_stop(tfinfo_t *ptf);
 
 #endif // _INFERENCE_H_
@@ -0,0 +1,133 @@
+// Embeddable C API over the segmentation pipeline & compositing, wrapping
+// caller buffers in cv::Mat headers so frames are never copied
+#include <stdio.h>
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "libdeepseg.h"
+#include "segment.h"
+#include "blend.h"
+
+#define DEEPSEG_MODEL "models/segm_full_v679.tflite"
+
+struct _deepseg_t {
+	deepseg_config_t cfg;
+	std::string model;
+	seginfo_t *pseg;
+	blendfn_t blend;
+	cv::Mat bg;			// background at frame size
+	cv::Mat mask;		// used when the caller wants no mask
+};
+
+void deepseg_defaults(deepseg_config_t *cfg) {
+	cfg->model = DEEPSEG_MODEL;
+	cfg->usehog = 0;
+	cfg->width = 640;
+	cfg->height = 480;
+	cfg->threads = 0;
+	cfg->flip = 0;
+	cfg->quality = 0;
+	cfg->debug = 0;
+}
+
+// TFLite wants -1 (not 0) for its default thread count
+static int tf_threads(int threads) {
+	return threads>0 ? threads : -1;
+}
+
+// (re)build the pipeline & frame sized buffers for cfg
+static bool deepseg_load(deepseg_t *ds, const deepseg_config_t *cfg) {
+	if (cfg->width<=0 || cfg->height<=0) {
+		fprintf(stderr, "Error: invalid frame size %dx%d\n", cfg->width, cfg->height);
+		return false;
+	}
+	const char *model = cfg->model ? cfg->model : DEEPSEG_MODEL;
+	seginfo_t *pseg = seg_init(model, cfg->usehog, cfg->width, cfg->height, tf_threads(cfg->threads), cfg->debug);
+	if (pseg==NULL)
+		return false;
+	if (ds->pseg)
+		seg_stop(ds->pseg);
+	ds->pseg = pseg;
+	ds->model = model;
+	// keep any background, rescaled
+	if (ds->bg.empty())
+		ds->bg = cv::Mat(cfg->height,cfg->width,CV_8UC3,cv::Scalar(0,255,0));
+	else if (ds->bg.cols!=cfg->width || ds->bg.rows!=cfg->height)
+		cv::resize(ds->bg,ds->bg,cv::Size(cfg->width,cfg->height));
+	ds->mask = cv::Mat::zeros(cfg->height,cfg->width,CV_32FC1);
+	return true;
+}
+
+deepseg_t *deepseg_create(const deepseg_config_t *cfg) {
+	deepseg_t *ds = new deepseg_t;
+	ds->pseg = NULL;
+	if (!deepseg_load(ds, cfg)) {
+		delete ds;
+		return NULL;
+	}
+	ds->cfg = *cfg;
+	ds->cfg.model = ds->model.c_str();
+	ds->blend = blend_select(cfg->flip);
+	seg_set_quality(ds->pseg, cfg->quality);
+	return ds;
+}
+
+int deepseg_configure(deepseg_t *ds, const deepseg_config_t *cfg) {
+	const char *model = cfg->model ? cfg->model : DEEPSEG_MODEL;
+	if (ds->model!=model || !ds->cfg.usehog!=!cfg->usehog ||
+		ds->cfg.width!=cfg->width || ds->cfg.height!=cfg->height) {
+		if (!deepseg_load(ds, cfg))
+			return -1;
+	} else if (ds->cfg.threads!=cfg->threads) {
+		seg_set_threads(ds->pseg, tf_threads(cfg->threads));
+	}
+	ds->cfg = *cfg;
+	ds->cfg.model = ds->model.c_str();
+	ds->blend = blend_select(cfg->flip);
+	seg_set_quality(ds->pseg, cfg->quality);
+	return 0;
+}
+
+int deepseg_set_background(deepseg_t *ds, const uint8_t *bgr, int width, int height, int stride) {
+	if (bgr==NULL || width<=0 || height<=0)
+		return -1;
+	cv::Mat img(height, width, CV_8UC3, (void *)bgr, stride);
+	cv::resize(img,ds->bg,cv::Size(ds->cfg.width,ds->cfg.height));
+	return 0;
+}
+
+int deepseg_process_frame(deepseg_t *ds, const uint8_t *in, int in_stride,
+	uint8_t *out, int out_stride, float *mask, int mask_stride) {
+	if (in==NULL || (out==NULL && mask==NULL))
+		return -1;
+	int w = ds->cfg.width, h = ds->cfg.height;
+	cv::Mat cap(h, w, CV_8UC3, (void *)in, in_stride);
+	cv::Mat msk = ds->mask;
+	if (mask!=NULL) {
+		// only the model's aspect ROI gets written, clear around it
+		msk = cv::Mat(h, w, CV_32FC1, mask, mask_stride);
+		cv::Rect roi = seg_roi(ds->pseg);
+		msk.rowRange(0, roi.y).setTo(0);
+		msk.rowRange(roi.y+roi.height, h).setTo(0);
+		msk(cv::Rect(0, roi.y, roi.x, roi.height)).setTo(0);
+		msk(cv::Rect(roi.x+roi.width, roi.y, w-roi.x-roi.width, roi.height)).setTo(0);
+	}
+	if (!seg_prepare(ds->pseg, cap) || !seg_infer(ds->pseg) || !seg_mask(ds->pseg, msk))
+		return -1;
+	if (out!=NULL) {
+		cv::Mat dst(h, w, CV_8UC3, out, out_stride);
+		// flipping writes rows/pixels mirrored, so needs a separate source
+		if (out==in && ds->cfg.flip)
+			cap = cap.clone();
+		ds->blend(cap, ds->bg, msk, dst);
+	}
+	return 0;
+}
+
+void deepseg_destroy(deepseg_t *ds) {
+	if (ds->pseg)
+		seg_stop(ds->pseg);
+	delete ds;
+}
@@ -0,0 +1,58 @@
+#ifndef _LIBDEEPSEG_H_
+#define _LIBDEEPSEG_H_
+
+/* Embeddable segmentation & compositing: frames are processed directly in
+ * caller-owned buffers, no capture or loopback devices involved. All
+ * images are packed BGR24 (3 bytes/pixel), masks are float per pixel
+ * (1.0 => person), strides are in bytes. Functions returning int give 0
+ * on success and -1 on failure. A deepseg_t must not be used from more
+ * than one thread at a time. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// opaque type for callers
+struct _deepseg_t;
+typedef struct _deepseg_t deepseg_t;
+
+// output orientation
+#define DEEPSEG_FLIP_VERT	0x01
+#define DEEPSEG_FLIP_HORZ	0x02
+
+// mask postprocessing shortcuts (as SEG_* in segment.h)
+#define DEEPSEG_NODENOISE	0x01
+#define DEEPSEG_NOLARGE		0x02
+#define DEEPSEG_NOBLUR		0x04
+#define DEEPSEG_FASTSCALE	0x08
+
+typedef struct {
+	const char *model;	// TFLite model file, NULL for the default
+	int usehog;			// use dlib's HOG face detector instead of a model
+	int width, height;	// frame size
+	int threads;		// TFLite threads, 0 (or <0) for TFLite's default
+	int flip;			// DEEPSEG_FLIP_* applied to composited output
+	int quality;		// DEEPSEG_NO*/FASTSCALE flags
+	int debug;
+} deepseg_config_t;
+
+void deepseg_defaults(deepseg_config_t *cfg);
+deepseg_t *deepseg_create(const deepseg_config_t *cfg);
+// apply a new configuration, reloading the pipeline only if the model or
+// frame size changed (on failure the previous configuration stays active)
+int deepseg_configure(deepseg_t *ds, const deepseg_config_t *cfg);
+// copy (and scale) a background image, default is green
+int deepseg_set_background(deepseg_t *ds, const uint8_t *bgr, int width, int height, int stride);
+// segment in, then write the mask and/or the composite of in over the
+// background into out (either may be NULL, not both; out may equal in)
+int deepseg_process_frame(deepseg_t *ds, const uint8_t *in, int in_stride,
+	uint8_t *out, int out_stride, float *mask, int mask_stride);
+void deepseg_destroy(deepseg_t *ds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _LIBDEEPSEG_H_
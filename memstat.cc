@@ -0,0 +1,42 @@
+// Memory footprint: resident set size split by what is mapped, so file
+// backed model weights, dlib and code can be told apart from the heap
+#include <stdio.h>
+#include <string.h>
+
+#include "memstat.h"
+
+bool memstat_read(memstat_t *pms) {
+	memset(pms, 0, sizeof(*pms));
+	FILE *fp = fopen("/proc/self/smaps", "r");
+	if (!fp)
+		return false;
+	char line[512];
+	size_t *cur = &pms->anon;
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = 0;
+		size_t kb;
+		if (sscanf(line, "Rss: %zu kB", &kb)==1) {
+			*cur += kb*1024;
+			pms->rss += kb*1024;
+			continue;
+		}
+		// mapping header: <start>-<end> <perms> <offset> <dev> <inode> [<path>]
+		unsigned long lo, hi;
+		char perms[8];
+		int at = 0;
+		if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %n", &lo, &hi, perms, &at)<3)
+			continue;
+		const char *path = at ? line+at : "";
+		if (path[0]!='/')
+			cur = &pms->anon;
+		else if (strstr(path, ".tflite"))
+			cur = &pms->model;
+		else if (strstr(path, "dlib") || strstr(path, "deepseg-hog") ||
+			strstr(path, "libblas") || strstr(path, "liblapack"))
+			cur = &pms->dlib;
+		else
+			cur = &pms->code;
+	}
+	fclose(fp);
+	return true;
+}
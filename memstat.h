@@ -0,0 +1,17 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+#include <stddef.h>
+
+// resident memory by mapping, from /proc/self/smaps (bytes)
+typedef struct {
+	size_t rss;		// total
+	size_t model;	// mapped .tflite files
+	size_t dlib;	// HOG plugin, dlib, BLAS & LAPACK
+	size_t code;	// other files: binary & libraries
+	size_t anon;	// heap, stacks & anonymous mappings (arenas, Mats, caches)
+} memstat_t;
+
+bool memstat_read(memstat_t *pms);
+
+#endif // _MEMSTAT_H_
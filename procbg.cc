@@ -0,0 +1,249 @@
+// Procedural animated backgrounds: drifting gradients, slow noise fields
+// and parallax hills, rendered straight into BGR24 by per-row kernels
+// (compiled for each ISA level, see dispatch.h) at a fraction of the
+// output size, then upscaled. No decoder thread, a few ms per frame.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "procbg.h"
+#include "dispatch.h"
+
+#define PROCBG_GRADIENT	0
+#define PROCBG_NOISE	1
+#define PROCBG_PARALLAX	2
+#define PROCBG_DIV		4	// default render scale (1/4 size)
+#define PROCBG_MAXDIV	16
+#define PARALLAX_LAYERS	3
+
+static const char *kinds[] = { "gradient", "noise", "parallax" };
+
+// palettes (BGR): gradient end colours drift between two pairs, noise maps
+// dark -> mid -> light, parallax is sky top & bottom then far to near hills
+static const float grad_pal[4][3] = { {96,32,24}, {160,112,32}, {128,40,104}, {64,104,176} };
+static const float noise_pal[3][3] = { {48,24,16}, {144,88,40}, {216,196,168} };
+static const float sky_pal[2][3] = { {208,152,96}, {216,208,232} };
+static const float hill_pal[PARALLAX_LAYERS][3] = { {176,144,128}, {128,104,84}, {72,56,44} };
+
+// hill layers, far to near: horizon (fraction of height), amplitude,
+// features across the width, drift (features per second)
+static const float hill_base[PARALLAX_LAYERS] = { 0.45f, 0.60f, 0.75f };
+static const float hill_amp[PARALLAX_LAYERS] = { 0.18f, 0.14f, 0.10f };
+static const float hill_freq[PARALLAX_LAYERS] = { 2.0f, 3.0f, 4.5f };
+static const float hill_speed[PARALLAX_LAYERS] = { 0.02f, 0.06f, 0.15f };
+
+struct _procinfo_t {
+	int kind;
+	int div;			// render at 1/div of the output size
+	int64 start;		// animation time origin
+	cv::Mat img;		// reduced size render, upscaled into the output
+	std::vector<float> ridge;	// parallax: hill heights, per layer & column
+	int debug;
+};
+
+// per-frame parameters, shared by the row kernels
+typedef struct {
+	float c[3][3];		// palette for this frame
+	float s0, sx, sy;	// gradient: phase and steps per pixel
+	float x0, y0, x1, y1, d;	// noise: octave offsets and step per pixel
+	float edge;			// parallax: 1/hill edge softness (pixels)
+} procframe_t;
+
+// integer lattice hash, vectorises (SSE4.1 and up have 32-bit multiplies)
+static CPU_KERNEL float lattice(int32_t x, int32_t y) {
+	uint32_t h = (uint32_t)x*0x27d4eb2du ^ (uint32_t)y*0x165667b1u;
+	h = (h ^ (h >> 15)) * 0x85ebca6bu;
+	h ^= h >> 13;
+	return (float)(h & 0xffff) * (1.0f/65535.0f);
+}
+
+static CPU_KERNEL float smooth(float u) {
+	return u*u*(3.0f-2.0f*u);
+}
+
+// value noise in [0, 1], smoothly interpolated between lattice points
+static CPU_KERNEL float vnoise(float x, float y) {
+	float fx = floorf(x), fy = floorf(y);
+	int32_t ix = (int32_t)fx, iy = (int32_t)fy;
+	float u = smooth(x-fx), v = smooth(y-fy);
+	float a = lattice(ix, iy), b = lattice(ix+1, iy);
+	float c = lattice(ix, iy+1), d = lattice(ix+1, iy+1);
+	return a + (b-a)*u + (c-a)*v + (a-b-c+d)*u*v;
+}
+
+static CPU_KERNEL float vnoise1(float x, int32_t seed) {
+	float fx = floorf(x);
+	int32_t ix = (int32_t)fx;
+	float u = smooth(x-fx);
+	float a = lattice(ix, seed), b = lattice(ix+1, seed);
+	return a + (b-a)*u;
+}
+
+// triangle wave along s, eased, blending c0 -> c1 -> c0
+static CPU_KERNEL void gradient_row(uint8_t *o, int n, float s0, float ds, const float *c0, const float *c1) {
+	for (int x=0; x<n; ++x) {
+		float s = s0 + ds*x;
+		float w = smooth(fabsf(2.0f*(s-floorf(s)) - 1.0f));
+		for (int c=0; c<3; ++c)
+			o[x*3+c] = (uint8_t)(c0[c] + (c1[c]-c0[c])*w);
+	}
+}
+CPU_VARIANTS(void, gradient_row, (uint8_t *o, int n, float s0, float ds, const float *c0, const float *c1),
+	(o, n, s0, ds, c0, c1))
+
+// two octaves of value noise, drifting in different directions, mapped
+// through a three colour palette
+static CPU_KERNEL void noise_row(uint8_t *o, int n, float x0, float y0, float x1, float y1, float d, const float *pal) {
+	for (int x=0; x<n; ++x) {
+		float v = 0.65f*vnoise(x0 + d*x, y0) + 0.35f*vnoise(x1 + 2.03f*d*x, y1);
+		float w1 = fminf(2.0f*v, 1.0f), w2 = fmaxf(2.0f*v - 1.0f, 0.0f);
+		for (int c=0; c<3; ++c)
+			o[x*3+c] = (uint8_t)(pal[c] + (pal[3+c]-pal[c])*w1 + (pal[6+c]-pal[3+c])*w2);
+	}
+}
+CPU_VARIANTS(void, noise_row, (uint8_t *o, int n, float x0, float y0, float x1, float y1, float d, const float *pal),
+	(o, n, x0, y0, x1, y1, d, pal))
+
+// hill outline (row of the top edge) for each column
+static CPU_KERNEL void ridge_cols(float *h, int n, float x0, float dx, float base, float amp, int32_t seed) {
+	for (int x=0; x<n; ++x) {
+		float px = x0 + dx*x;
+		h[x] = base - amp*(0.7f*vnoise1(px, seed) + 0.3f*vnoise1(2.7f*px, seed+101));
+	}
+}
+CPU_VARIANTS(void, ridge_cols, (float *h, int n, float x0, float dx, float base, float amp, int32_t seed),
+	(h, n, x0, dx, base, amp, seed))
+
+// sky colour for the row, then each hill layer (far to near) over it with
+// a soft top edge
+static CPU_KERNEL void parallax_row(uint8_t *o, int n, float y, const float *sky, const float *ridge, const float *pal, float edge) {
+	for (int x=0; x<n; ++x) {
+		float b = sky[0], g = sky[1], r = sky[2];
+		for (int k=0; k<PARALLAX_LAYERS; ++k) {
+			float a = fminf(fmaxf((y - ridge[k*n+x])*edge, 0.0f), 1.0f);
+			b += (pal[k*3  ]-b)*a;
+			g += (pal[k*3+1]-g)*a;
+			r += (pal[k*3+2]-r)*a;
+		}
+		o[x*3  ] = (uint8_t)b;
+		o[x*3+1] = (uint8_t)g;
+		o[x*3+2] = (uint8_t)r;
+	}
+}
+CPU_VARIANTS(void, parallax_row, (uint8_t *o, int n, float y, const float *sky, const float *ridge, const float *pal, float edge),
+	(o, n, y, sky, ridge, pal, edge))
+
+static void lerp3(const float *a, const float *b, float w, float *out) {
+	for (int c=0; c<3; ++c)
+		out[c] = a[c] + (b[c]-a[c])*w;
+}
+
+// render rows on the calling (render) thread: at reduced size a frame is
+// well under a millisecond, and OpenCV's pool would run it at the
+// inference thread's scheduling policy (see BLEND_SERIAL)
+class ProcRows : public cv::ParallelLoopBody {
+	const procinfo_t *ppg;
+	const procframe_t& pf;
+	cv::Mat& img;
+public:
+	ProcRows(const procinfo_t *p, const procframe_t& f, cv::Mat& i) : ppg(p), pf(f), img(i) {}
+	virtual void operator()(const cv::Range& rows) const {
+		int n = img.cols;
+		for (int y=rows.start; y<rows.end; ++y) {
+			uint8_t *o = img.ptr<uint8_t>(y);
+			if (ppg->kind==PROCBG_GRADIENT) {
+				CPU_SELECT(gradient_row)(o, n, pf.s0 + pf.sy*y, pf.sx, pf.c[0], pf.c[1]);
+			} else if (ppg->kind==PROCBG_NOISE) {
+				CPU_SELECT(noise_row)(o, n, pf.x0, pf.y0 + pf.d*y, pf.x1, pf.y1 + 2.03f*pf.d*y, pf.d, pf.c[0]);
+			} else {
+				float sky[3];
+				lerp3(sky_pal[0], sky_pal[1], (float)y/img.rows, sky);
+				CPU_SELECT(parallax_row)(o, n, (float)y, sky, ppg->ridge.data(), hill_pal[0], pf.edge);
+			}
+		}
+	}
+};
+
+bool procbg_spec(const char *back) {
+	return back && strncmp(back, PROCBG_PREFIX, strlen(PROCBG_PREFIX))==0;
+}
+
+procinfo_t *procbg_init(const char *spec, int debug) {
+	if (!procbg_spec(spec))
+		return NULL;
+	const char *name = spec + strlen(PROCBG_PREFIX);
+	const char *colon = strchr(name, ':');
+	size_t len = colon ? (size_t)(colon-name) : strlen(name);
+	int kind = -1;
+	for (int k=0; k<3; k++) {
+		if (strlen(kinds[k])==len && strncmp(name, kinds[k], len)==0)
+			kind = k;
+	}
+	if (kind<0) {
+		fprintf(stderr, "Error: unknown procedural background: %s (gradient, noise or parallax)\n", spec);
+		return NULL;
+	}
+	int div = colon ? atoi(colon+1) : PROCBG_DIV;
+	if (div<1 || div>PROCBG_MAXDIV) {
+		fprintf(stderr, "Error: procedural background scale must be 1..%d: %s\n", PROCBG_MAXDIV, spec);
+		return NULL;
+	}
+	procinfo_t *ppg = new procinfo_t;
+	ppg->kind = kind;
+	ppg->div = div;
+	ppg->start = cv::getTickCount();
+	ppg->debug = debug;
+	if (debug)
+		printf("procbg: %s at 1/%d size, %s kernels\n", kinds[kind], div, cpu_name(cpu_level()));
+	return ppg;
+}
+
+void procbg_frame(procinfo_t *ppg, int w, int h, cv::Mat& out) {
+	double t = (cv::getTickCount()-ppg->start)/cv::getTickFrequency();
+	int rw = std::max(w/ppg->div, 2), rh = std::max(h/ppg->div, 2);
+	// render straight into the output at full size
+	cv::Mat& img = ppg->div>1 ? ppg->img : out;
+	img.create(rh, rw, CV_8UC3);
+
+	procframe_t pf;
+	if (ppg->kind==PROCBG_GRADIENT) {
+		// end colours swap over a minute, direction turns every 90s, bands
+		// move across in 20s
+		float drift = 0.5f - 0.5f*(float)cos(t*2.0*M_PI/60.0);
+		lerp3(grad_pal[0], grad_pal[2], drift, pf.c[0]);
+		lerp3(grad_pal[1], grad_pal[3], drift, pf.c[1]);
+		double a = fmod(t, 90.0)*2.0*M_PI/90.0;
+		float period = 1.5f*std::max(rw, rh);
+		pf.sx = (float)cos(a)/period;
+		pf.sy = (float)sin(a)/period;
+		pf.s0 = (float)fmod(t/20.0, 1.0);
+	} else if (ppg->kind==PROCBG_NOISE) {
+		memcpy(pf.c, noise_pal, sizeof(noise_pal));
+		// three features across the width, at any render size
+		pf.d = 3.0f/rw;
+		pf.x0 = (float)(t*0.020);
+		pf.y0 = (float)(t*0.007);
+		pf.x1 = (float)(17.3 - t*0.035);
+		pf.y1 = (float)(5.1 + t*0.025);
+	} else {
+		ppg->ridge.resize(PARALLAX_LAYERS*rw);
+		for (int k=0; k<PARALLAX_LAYERS; k++)
+			CPU_SELECT(ridge_cols)(&ppg->ridge[k*rw], rw, (float)(t*hill_speed[k]), hill_freq[k]/rw,
+				hill_base[k]*rh, hill_amp[k]*rh, k+1);
+		pf.edge = 1.0f/1.5f;
+	}
+	ProcRows(ppg, pf, img)(cv::Range(0, rh));
+
+	if (ppg->div>1)
+		cv::resize(img, out, cv::Size(w, h), 0, 0, cv::INTER_LINEAR);
+}
+
+void procbg_stop(procinfo_t *ppg) {
+	delete ppg;
+}
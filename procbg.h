@@ -0,0 +1,20 @@
+#ifndef _PROCBG_H_
+#define _PROCBG_H_
+
+#include <opencv2/core/mat.hpp>
+
+// procedural animated backgrounds, selected with -b proc:<kind>[:<div>],
+// kind one of gradient, noise or parallax, rendered at 1/div of the
+// output size (default 4) and upscaled
+#define PROCBG_PREFIX	"proc:"
+
+struct _procinfo_t;
+typedef struct _procinfo_t procinfo_t;
+
+bool procbg_spec(const char *back);
+procinfo_t *procbg_init(const char *spec, int debug);
+// render the background as of now into out (BGR24, w x h)
+void procbg_frame(procinfo_t *ppg, int w, int h, cv::Mat& out);
+void procbg_stop(procinfo_t *ppg);
+
+#endif // _PROCBG_H_
@@ -0,0 +1,276 @@
+// Python extension module (_deepseg) over libdeepseg: frames, masks and
+// outputs are any buffer protocol objects (e.g. numpy arrays from cv2),
+// accessed in place, with the GIL released while processing
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <opencv2/core.hpp>
+
+#include "libdeepseg.h"
+#include "blend.h"
+
+typedef struct {
+	PyObject_HEAD
+	deepseg_t *ds;
+	int w, h;
+} SegmenterObject;
+
+// view over n (or 1 if n==0) H x W x C images of format fmt, with
+// packed pixels (rows may be padded, frames may be strided)
+typedef struct {
+	Py_buffer buf;
+	char *data;
+	Py_ssize_t fstride;	// bytes between frames
+	int rstride;		// bytes between rows
+	Py_ssize_t n;
+} view_t;
+
+static bool get_view(PyObject *obj, view_t *pv, bool batch, int w, int h, int c, const char *fmt,
+	Py_ssize_t isize, bool writable, const char *name) {
+	if (obj==NULL || obj==Py_None) {
+		pv->data = NULL;
+		pv->rstride = 0;
+		pv->fstride = 0;
+		pv->n = 0;
+		return true;
+	}
+	if (PyObject_GetBuffer(obj, &pv->buf, PyBUF_STRIDES | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) < 0)
+		return false;
+	int ndim = (batch ? 1 : 0) + 2 + (c>1 ? 1 : 0);
+	Py_ssize_t *shape = pv->buf.shape + (batch ? 1 : 0);
+	Py_ssize_t *strides = pv->buf.strides + (batch ? 1 : 0);
+	// native byte order only
+	const char *bfmt = pv->buf.format + strspn(pv->buf.format, "@=");
+	if (pv->buf.ndim!=ndim || strcmp(bfmt, fmt)!=0 || pv->buf.itemsize!=isize ||
+		shape[0]!=h || shape[1]!=w || (c>1 && (shape[2]!=c || strides[2]!=isize)) ||
+		strides[1]!=isize*c) {
+		PyErr_Format(PyExc_ValueError, "%s must be %s%dx%d%s%s with packed pixels", name,
+			batch ? "N x " : "", h, w, c>1 ? "x3" : "", c>1 ? " uint8" : " float32");
+		PyBuffer_Release(&pv->buf);
+		return false;
+	}
+	pv->data = (char *)pv->buf.buf;
+	pv->rstride = (int)strides[0];
+	pv->fstride = batch ? pv->buf.strides[0] : 0;
+	pv->n = batch ? pv->buf.shape[0] : 1;
+	return true;
+}
+
+static void put_view(view_t *pv) {
+	if (pv->data)
+		PyBuffer_Release(&pv->buf);
+}
+
+static int Segmenter_init(SegmenterObject *self, PyObject *args, PyObject *kwds) {
+	static const char *kwlist[] = { "width", "height", "model", "threads", "hog", "flip", "quality", "debug", NULL };
+	deepseg_config_t cfg;
+	deepseg_defaults(&cfg);
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ii|ziiiii", (char **)kwlist, &cfg.width, &cfg.height,
+		&cfg.model, &cfg.threads, &cfg.usehog, &cfg.flip, &cfg.quality, &cfg.debug))
+		return -1;
+	if (self->ds)
+		deepseg_destroy(self->ds);
+	Py_BEGIN_ALLOW_THREADS
+	self->ds = deepseg_create(&cfg);
+	Py_END_ALLOW_THREADS
+	if (self->ds==NULL) {
+		PyErr_SetString(PyExc_RuntimeError, "could not create segmentation pipeline");
+		return -1;
+	}
+	self->w = cfg.width;
+	self->h = cfg.height;
+	return 0;
+}
+
+static void Segmenter_dealloc(SegmenterObject *self) {
+	if (self->ds)
+		deepseg_destroy(self->ds);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// NULL until a successful __init__()
+static bool initialised(SegmenterObject *self) {
+	if (self->ds==NULL)
+		PyErr_SetString(PyExc_RuntimeError, "Segmenter not initialised");
+	return self->ds!=NULL;
+}
+
+// shared by process() and process_batch(): frames in, masks and/or composites out
+static PyObject *segment(SegmenterObject *self, PyObject *args, PyObject *kwds, bool batch) {
+	static const char *kwlist[] = { "frames", "out", "mask", NULL };
+	PyObject *fobj, *oobj = NULL, *mobj = NULL;
+	if (!initialised(self) || !PyArg_ParseTupleAndKeywords(args, kwds, "O|OO", (char **)kwlist, &fobj, &oobj, &mobj))
+		return NULL;
+	if (fobj==Py_None || ((oobj==NULL || oobj==Py_None) && (mobj==NULL || mobj==Py_None))) {
+		PyErr_SetString(PyExc_ValueError, "need frames, and an out and/or mask buffer");
+		return NULL;
+	}
+	view_t in, out, mask;
+	if (!get_view(fobj, &in, batch, self->w, self->h, 3, "B", 1, false, "frames"))
+		return NULL;
+	if (!get_view(oobj, &out, batch, self->w, self->h, 3, "B", 1, true, "out")) {
+		put_view(&in);
+		return NULL;
+	}
+	if (!get_view(mobj, &mask, batch, self->w, self->h, 1, "f", 4, true, "mask")) {
+		put_view(&in);
+		put_view(&out);
+		return NULL;
+	}
+	bool ok = (out.data==NULL || out.n==in.n) && (mask.data==NULL || mask.n==in.n);
+	if (!ok) {
+		PyErr_SetString(PyExc_ValueError, "frame counts differ");
+	} else {
+		Py_BEGIN_ALLOW_THREADS
+		for (Py_ssize_t f=0; ok && f<in.n; f++) {
+			ok = deepseg_process_frame(self->ds,
+				(const uint8_t *)in.data + f*in.fstride, in.rstride,
+				out.data ? (uint8_t *)out.data + f*out.fstride : NULL, out.rstride,
+				mask.data ? (float *)(mask.data + f*mask.fstride) : NULL, mask.rstride)==0;
+		}
+		Py_END_ALLOW_THREADS
+		if (!ok)
+			PyErr_SetString(PyExc_RuntimeError, "segmentation failed");
+	}
+	put_view(&in);
+	put_view(&out);
+	put_view(&mask);
+	if (!ok)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *Segmenter_process(SegmenterObject *self, PyObject *args, PyObject *kwds) {
+	return segment(self, args, kwds, false);
+}
+
+static PyObject *Segmenter_process_batch(SegmenterObject *self, PyObject *args, PyObject *kwds) {
+	return segment(self, args, kwds, true);
+}
+
+static PyObject *Segmenter_set_background(SegmenterObject *self, PyObject *args) {
+	PyObject *bobj;
+	if (!initialised(self) || !PyArg_ParseTuple(args, "O", &bobj))
+		return NULL;
+	Py_buffer buf;
+	if (PyObject_GetBuffer(bobj, &buf, PyBUF_STRIDES | PyBUF_FORMAT) < 0)
+		return NULL;
+	int ret = -1;
+	if (buf.ndim==3 && strcmp(buf.format, "B")==0 && buf.shape[2]==3 && buf.strides[2]==1 && buf.strides[1]==3)
+		ret = deepseg_set_background(self->ds, (const uint8_t *)buf.buf, (int)buf.shape[1], (int)buf.shape[0], (int)buf.strides[0]);
+	PyBuffer_Release(&buf);
+	if (ret) {
+		PyErr_SetString(PyExc_ValueError, "background must be H x W x 3 uint8 with packed pixels");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef Segmenter_methods[] = {
+	{ "process", (PyCFunction)Segmenter_process, METH_VARARGS | METH_KEYWORDS,
+		"process(frame, out=None, mask=None): segment an HxWx3 BGR frame, writing the\n"
+		"HxW float32 mask and/or the composite over the background (out may be frame)" },
+	{ "process_batch", (PyCFunction)Segmenter_process_batch, METH_VARARGS | METH_KEYWORDS,
+		"process_batch(frames, out=None, mask=None): as process() for N frames" },
+	{ "set_background", (PyCFunction)Segmenter_set_background, METH_VARARGS,
+		"set_background(image): HxWx3 BGR background, scaled to the frame size" },
+	{ NULL }
+};
+
+static PyTypeObject SegmenterType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"_deepseg.Segmenter",
+};
+
+// blend(frame, background, mask, out): compositing kernel on its own
+static PyObject *deepseg_blend(PyObject *self, PyObject *args) {
+	PyObject *fobj, *bobj, *mobj, *oobj;
+	if (!PyArg_ParseTuple(args, "OOOO", &fobj, &bobj, &mobj, &oobj))
+		return NULL;
+	Py_buffer fb;
+	if (PyObject_GetBuffer(fobj, &fb, PyBUF_STRIDES | PyBUF_FORMAT) < 0)
+		return NULL;
+	if (fb.ndim!=3) {
+		PyBuffer_Release(&fb);
+		PyErr_SetString(PyExc_ValueError, "frame must be H x W x 3 uint8");
+		return NULL;
+	}
+	int w = (int)fb.shape[1], h = (int)fb.shape[0];
+	PyBuffer_Release(&fb);
+	view_t in, bg, mask, out;
+	if (!get_view(fobj, &in, false, w, h, 3, "B", 1, false, "frame"))
+		return NULL;
+	bool ok = get_view(bobj, &bg, false, w, h, 3, "B", 1, false, "background");
+	if (ok && !(ok = get_view(mobj, &mask, false, w, h, 1, "f", 4, false, "mask")))
+		put_view(&bg);
+	if (ok && !(ok = get_view(oobj, &out, false, w, h, 3, "B", 1, true, "out"))) {
+		put_view(&bg);
+		put_view(&mask);
+	}
+	if (ok && (bg.data==NULL || mask.data==NULL || out.data==NULL)) {
+		PyErr_SetString(PyExc_ValueError, "all buffers are required");
+		put_view(&bg);
+		put_view(&mask);
+		put_view(&out);
+		ok = false;
+	}
+	if (ok) {
+		cv::Mat cm(h, w, CV_8UC3, in.data, in.rstride);
+		cv::Mat bm(h, w, CV_8UC3, bg.data, bg.rstride);
+		cv::Mat mm(h, w, CV_32FC1, mask.data, mask.rstride);
+		cv::Mat om(h, w, CV_8UC3, out.data, out.rstride);
+		Py_BEGIN_ALLOW_THREADS
+		blend_frame(cm, bm, mm, om);
+		Py_END_ALLOW_THREADS
+		put_view(&bg);
+		put_view(&mask);
+		put_view(&out);
+	}
+	put_view(&in);
+	if (!ok)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef deepseg_methods[] = {
+	{ "blend", deepseg_blend, METH_VARARGS,
+		"blend(frame, background, mask, out): alpha blend HxWx3 BGR frame over background\n"
+		"using the HxW float32 mask (1.0 => frame)" },
+	{ NULL }
+};
+
+static struct PyModuleDef deepseg_module = {
+	PyModuleDef_HEAD_INIT,
+	"_deepseg",
+	"deepseg segmentation & compositing on numpy (buffer protocol) arrays",
+	-1,
+	deepseg_methods,
+};
+
+PyMODINIT_FUNC PyInit__deepseg(void) {
+	SegmenterType.tp_basicsize = sizeof(SegmenterObject);
+	SegmenterType.tp_flags = Py_TPFLAGS_DEFAULT;
+	SegmenterType.tp_doc = "Segmenter(width, height, model=None, threads=0, hog=0, flip=0, quality=0, debug=0)";
+	SegmenterType.tp_new = PyType_GenericNew;
+	SegmenterType.tp_init = (initproc)Segmenter_init;
+	SegmenterType.tp_dealloc = (destructor)Segmenter_dealloc;
+	SegmenterType.tp_methods = Segmenter_methods;
+	if (PyType_Ready(&SegmenterType) < 0)
+		return NULL;
+	PyObject *m = PyModule_Create(&deepseg_module);
+	if (m==NULL)
+		return NULL;
+	Py_INCREF(&SegmenterType);
+	if (PyModule_AddObject(m, "Segmenter", (PyObject *)&SegmenterType) < 0) {
+		Py_DECREF(&SegmenterType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	PyModule_AddIntConstant(m, "FLIP_VERT", DEEPSEG_FLIP_VERT);
+	PyModule_AddIntConstant(m, "FLIP_HORZ", DEEPSEG_FLIP_HORZ);
+	PyModule_AddIntConstant(m, "NODENOISE", DEEPSEG_NODENOISE);
+	PyModule_AddIntConstant(m, "NOLARGE", DEEPSEG_NOLARGE);
+	PyModule_AddIntConstant(m, "NOBLUR", DEEPSEG_NOBLUR);
+	PyModule_AddIntConstant(m, "FASTSCALE", DEEPSEG_FASTSCALE);
+	return m;
+}
@@ -0,0 +1,221 @@
+// Memory residency: a cv::Mat allocator serving large buffers (frames,
+// masks, backgrounds) from huge pages, prefaulted at allocation and kept
+// on a (bounded) free list for reuse, so steady state frames take no page
+// faults
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <map>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "residency.h"
+
+#define HUGE_PAGE	(2*1024*1024)
+#define MIN_RESIDENT	(256*1024)	// smaller buffers use OpenCV's allocator
+#define MAX_IDLE	8			// idle blocks kept for reuse, the largest unmapped beyond
+
+static int rflags = 0;
+static int rdebug = 0;
+
+// everything made resident, for resident_fork()
+typedef struct {
+	void *p;
+	size_t len;
+	bool writable;
+	bool hugetlb;	// shared reserved huge pages, see ResidentAllocator::get()
+} region_t;
+static pthread_mutex_t rlock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<region_t> regions;
+
+// huge page advice, prefault & optional lock of a page aligned region
+static void make_resident(void *p, size_t len, bool writable) {
+#ifdef MADV_HUGEPAGE
+	madvise(p, len, MADV_HUGEPAGE);
+#endif
+	long pg = sysconf(_SC_PAGESIZE);
+	volatile char *c = (volatile char *)p;
+	for (size_t o=0; o<len; o+=pg) {
+		if (writable)
+			c[o] = c[o];
+		else
+			(void)c[o];
+	}
+	if ((rflags & RESIDENT_LOCK) && mlock(p, len)) {
+		static bool warned = false;
+		if (!warned)
+			perror("Warning: mlock (check RLIMIT_MEMLOCK)");
+		warned = true;
+	}
+}
+
+static void add_region(void *p, size_t len, bool writable, bool hugetlb=false) {
+	region_t r = { p, len, writable, hugetlb };
+	pthread_mutex_lock(&rlock);
+	regions.push_back(r);
+	pthread_mutex_unlock(&rlock);
+}
+
+static void remove_region(void *p) {
+	pthread_mutex_lock(&rlock);
+	for (size_t i=0; i<regions.size(); i++) {
+		if (regions[i].p == p) {
+			regions.erase(regions.begin()+i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&rlock);
+}
+
+class ResidentAllocator : public cv::MatAllocator {
+	mutable pthread_mutex_t lock;
+	mutable std::multimap<size_t, void *> idle;	// recycled blocks by size
+	mutable size_t mapped;
+public:
+	ResidentAllocator() : mapped(0) {
+		pthread_mutex_init(&lock, NULL);
+	}
+	// a block of at least len bytes, len updated to its actual size
+	void *get(size_t& len) const {
+		pthread_mutex_lock(&lock);
+		// best fit, but not wasting more than the block is used
+		std::multimap<size_t, void *>::iterator it = idle.lower_bound(len);
+		void *p = NULL;
+		if (it != idle.end() && it->first <= 2*len) {
+			len = it->first;
+			p = it->second;
+			idle.erase(it);
+		}
+		pthread_mutex_unlock(&lock);
+		if (p)
+			return p;
+		// explicit huge pages if reserved, else transparent huge pages.
+		// Reserved ones are shared, not private: a -Z worker writing a private
+		// hugetlb page would copy it into a second set of reserved pages (and
+		// get SIGBUS once the reservation, sized for one pipeline, runs out);
+		// the supervisor never touches them after its warm-up run
+		bool hugetlb = true;
+		p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED) {
+			hugetlb = false;
+			p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		}
+		if (p == MAP_FAILED)
+			return NULL;
+		make_resident(p, len, true);
+		add_region(p, len, true, hugetlb);
+		pthread_mutex_lock(&lock);
+		mapped += len;
+		if (rdebug) printf("\nresident: +%zuKB (%zuMB mapped)\n", len/1024, mapped/(1024*1024));
+		pthread_mutex_unlock(&lock);
+		return p;
+	}
+	void put(void *p, size_t len) const {
+		pthread_mutex_lock(&lock);
+		idle.insert(std::make_pair(len, p));
+		// too many idle (eg. after a size change): unmap the largest
+		void *drop = NULL;
+		size_t dlen = 0;
+		if (idle.size() > MAX_IDLE) {
+			std::multimap<size_t, void *>::iterator it = --idle.end();
+			drop = it->second;
+			dlen = it->first;
+			idle.erase(it);
+			mapped -= dlen;
+			if (rdebug) printf("\nresident: -%zuKB (%zuMB mapped)\n", dlen/1024, mapped/(1024*1024));
+		}
+		pthread_mutex_unlock(&lock);
+		if (drop) {
+			remove_region(drop);
+			munmap(drop, dlen);
+		}
+	}
+	cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+		int flags, cv::UMatUsageFlags usage) const {
+		size_t total = CV_ELEM_SIZE(type);
+		for (int i=dims-1; i>=0; i--) {
+			if (step) {
+				if (data0 && step[i] != CV_AUTOSTEP)
+					total = step[i];
+				else
+					step[i] = total;
+			}
+			total *= sizes[i];
+		}
+		if (data0 || total < MIN_RESIDENT)
+			return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usage);
+		size_t len = (total + HUGE_PAGE-1) & ~(size_t)(HUGE_PAGE-1);
+		uchar *data = (uchar *)get(len);
+		if (!data)
+			return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usage);
+		cv::UMatData *u = new cv::UMatData(this);
+		u->data = u->origdata = data;
+		u->size = len;
+		return u;
+	}
+#if CV_VERSION_MAJOR >= 4
+	bool allocate(cv::UMatData *u, cv::AccessFlag, cv::UMatUsageFlags) const {
+#else
+	bool allocate(cv::UMatData *u, int, cv::UMatUsageFlags) const {
+#endif
+		return u != NULL;
+	}
+	void deallocate(cv::UMatData *u) const {
+		if (!u)
+			return;
+		CV_Assert(u->urefcount == 0);
+		CV_Assert(u->refcount == 0);
+		put(u->origdata, u->size);
+		delete u;
+	}
+};
+
+bool resident_init(int flags, int debug) {
+	rflags = flags;
+	rdebug = debug;
+	if (!(flags & RESIDENT_HUGE))
+		return true;
+	static ResidentAllocator alloc;
+	cv::Mat::setDefaultAllocator(&alloc);
+	return true;
+}
+
+void resident_region(void *p, size_t len, bool writable) {
+	if (!(rflags & RESIDENT_HUGE) || !p || !len)
+		return;
+	// whole pages within the region only
+	long pg = sysconf(_SC_PAGESIZE);
+	uintptr_t lo = ((uintptr_t)p + pg-1) & ~(uintptr_t)(pg-1);
+	uintptr_t hi = ((uintptr_t)p + len) & ~(uintptr_t)(pg-1);
+	if (hi > lo) {
+		make_resident((void *)lo, hi-lo, writable);
+		add_region((void *)lo, hi-lo, writable);
+	}
+}
+
+// regions are never forgotten, so only for a child of a process that kept
+// its pipeline (deepseg -Z)
+void resident_fork() {
+	if (!(rflags & RESIDENT_HUGE))
+		return;
+	pthread_mutex_lock(&rlock);
+	std::vector<region_t> all = regions;
+	pthread_mutex_unlock(&rlock);
+	size_t len = 0;
+	for (auto& r : all) {
+		// shared huge pages are only mapped in, private ones copied now
+		make_resident(r.p, r.len, r.writable && !r.hugetlb);
+		len += r.len;
+	}
+	if (rdebug) printf("resident: %zuMB re-made resident after fork\n", len/(1024*1024));
+}
+
+long resident_faults() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt + ru.ru_majflt;
+}
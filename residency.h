@@ -0,0 +1,21 @@
+#ifndef _RESIDENCY_H_
+#define _RESIDENCY_H_
+
+#include <stddef.h>
+
+// memory residency modes
+#define RESIDENT_HUGE	0x01	// large buffers from huge pages, prefaulted & recycled
+#define RESIDENT_LOCK	0x02	// also mlock() them
+
+// install the cv::Mat allocator for large buffers (call before allocating
+// any pipeline buffers); everything else here is a no-op until then
+bool resident_init(int flags, int debug);
+// make existing memory resident: huge page advice, prefault, lock
+void resident_region(void *p, size_t len, bool writable);
+// in a fork()ed child: locks are not inherited and writable pages are
+// shared copy-on-write with the parent, so redo both for everything above
+void resident_fork();
+// page faults taken by the process so far (minor + major)
+long resident_faults();
+
+#endif // _RESIDENCY_H_
@@ -0,0 +1,138 @@
+// Per-stage scheduling policy and CPU affinity, specified on the command
+// line as: <stage>=[<policy>][:<priority>][@<cpulist>], eg:
+//   capture=fifo:10@0  background=idle  inference=other@1-3
+//
+// Threads inherit both from their creator, so applying the inference policy
+// to the main thread before the OpenCV pool and TFLite's workers start (they
+// are created lazily on first use) pins those workers too.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "schedpol.h"
+
+static const char *stages[STAGE_COUNT] = { "capture", "background", "inference" };
+
+static const struct { const char *name; int policy; } policies[] = {
+	{ "other", SCHED_OTHER },
+	{ "batch", SCHED_BATCH },
+	{ "idle",  SCHED_IDLE },
+	{ "fifo",  SCHED_FIFO },
+	{ "rr",    SCHED_RR },
+};
+
+void schedpol_init(schedpol_t *pols) {
+	for (int s=0; s<STAGE_COUNT; s++) {
+		pols[s].set = false;
+		pols[s].policy = SCHED_OTHER;
+		pols[s].priority = 0;
+		pols[s].pin = false;
+		CPU_ZERO(&pols[s].cpus);
+	}
+}
+
+// cpulist: <n>[-<m>][,...]
+static bool parse_cpus(const char *list, cpu_set_t *set) {
+	CPU_ZERO(set);
+	while (*list) {
+		char *end;
+		long lo = strtol(list, &end, 10), hi = lo;
+		if (end==list)
+			return false;
+		if (*end=='-') {
+			list = end+1;
+			hi = strtol(list, &end, 10);
+			if (end==list || hi<lo)
+				return false;
+		}
+		for (long c=lo; c<=hi && c<CPU_SETSIZE; c++)
+			CPU_SET(c, set);
+		if (*end==',')
+			++end;
+		else if (*end)
+			return false;
+		list = end;
+	}
+	return CPU_COUNT(set)>0;
+}
+
+bool schedpol_parse(const char *spec, schedpol_t *pols) {
+	// "render" is an alias, rendering runs in the capture callback
+	const char *eq = strchr(spec, '=');
+	if (!eq)
+		return false;
+	int stage = -1;
+	for (int s=0; s<STAGE_COUNT; s++)
+		if ((size_t)(eq-spec)==strlen(stages[s]) && strncmp(spec, stages[s], eq-spec)==0)
+			stage = s;
+	if ((size_t)(eq-spec)==6 && strncmp(spec, "render", 6)==0)
+		stage = STAGE_CAPTURE;
+	if (stage<0)
+		return false;
+	schedpol_t *pol = &pols[stage];
+	const char *p = eq+1;
+	size_t len = strcspn(p, ":@");
+	if (len) {
+		size_t n;
+		for (n=0; n<sizeof(policies)/sizeof(policies[0]); n++)
+			if (strlen(policies[n].name)==len && strncmp(p, policies[n].name, len)==0)
+				break;
+		if (n==sizeof(policies)/sizeof(policies[0]))
+			return false;
+		pol->set = true;
+		pol->policy = policies[n].policy;
+		pol->priority = (pol->policy==SCHED_FIFO || pol->policy==SCHED_RR) ? 1 : 0;
+		p += len;
+	}
+	if (*p==':') {
+		char *end;
+		pol->priority = (int)strtol(p+1, &end, 10);
+		if (end==p+1)
+			return false;
+		pol->set = true;
+		p = end;
+	}
+	if (*p=='@') {
+		if (!parse_cpus(p+1, &pol->cpus))
+			return false;
+		pol->pin = true;
+		p += strlen(p);
+	}
+	return *p==0;
+}
+
+bool schedpol_apply(pthread_t tid, const schedpol_t *pol, const char *name, int debug) {
+	bool ok = true;
+	if (pol->pin) {
+		int err = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &pol->cpus);
+		if (err) {
+			fprintf(stderr, "Warning: %s: could not set CPU affinity: %s\n", name, strerror(err));
+			ok = false;
+		}
+	}
+	if (pol->set) {
+		struct sched_param sp;
+		bool rt = (pol->policy==SCHED_FIFO || pol->policy==SCHED_RR);
+		sp.sched_priority = rt ? pol->priority : 0;
+		int err = pthread_setschedparam(tid, pol->policy, &sp);
+		if (err) {
+			// usually EPERM: needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance
+			fprintf(stderr, "Warning: %s: could not set scheduling policy: %s\n", name, strerror(err));
+			ok = false;
+		}
+	}
+	if (debug && (pol->set || pol->pin))
+		printf("sched: %s policy=%d prio=%d cpus=%d\n", name, pol->policy, pol->priority,
+			pol->pin ? CPU_COUNT(&pol->cpus) : 0);
+	return ok;
+}
+
+void schedpol_mutex_init(pthread_mutex_t *lock) {
+	// priority inheritance: a real-time render thread waiting on a lock held
+	// by a batch/idle inference thread boosts the holder instead of stalling
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
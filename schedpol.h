@@ -0,0 +1,27 @@
+#ifndef _SCHEDPOL_H_
+#define _SCHEDPOL_H_
+
+#include <pthread.h>
+#include <sched.h>
+
+// pipeline stages with their own thread(s)
+#define STAGE_CAPTURE		0	// camera grab & render (same thread)
+#define STAGE_BACKGROUND	1	// background video decode
+#define STAGE_INFERENCE		2	// main loop, TFLite & OpenCV workers
+#define STAGE_COUNT			3
+
+// scheduling policy & CPU affinity for one stage
+typedef struct {
+	bool set;			// policy/priority valid
+	int policy;			// SCHED_OTHER/BATCH/IDLE/FIFO/RR
+	int priority;		// FIFO/RR priority (1-99)
+	bool pin;			// cpus valid
+	cpu_set_t cpus;
+} schedpol_t;
+
+void schedpol_init(schedpol_t *pols);
+bool schedpol_parse(const char *spec, schedpol_t *pols);
+bool schedpol_apply(pthread_t tid, const schedpol_t *pol, const char *name, int debug);
+void schedpol_mutex_init(pthread_mutex_t *lock);
+
+#endif // _SCHEDPOL_H_
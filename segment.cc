@@ -0,0 +1,480 @@
+// Segmentation pipeline: capture frame in, full-size person mask out
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+#include "segment.h"
+#include "inference.h"
+#include "dlibhog.h"
+#include "dispatch.h"
+
+#define ASSERT_OR_NULL(x) { if (!(x)) return NULL; }
+
+// deeplabv3 classes
+static std::vector<std::string> labels = { "background", "aeroplane", "bicycle", "bird", "boat", "bottle", "bus", "car", "cat", "chair", "cow", "dining table", "dog", "horse", "motorbike", "person", "potted plant", "sheep", "sofa", "train", "tv" };
+#define DEEPLAB_CLASSES	21
+#define DEEPLAB_PERSON	15
+
+// mean absolute difference (0..255) between successive model inputs taken
+// as a scene cut by recurrent models
+#define SCENE_CUT	48
+
+// The stage chain (preprocess -> infer -> decode -> filter) is resolved
+// once in seg_init() to function pointers, with model decoders compiled per
+// ISA level (dispatch.h), so there are no per-frame model or detector branches.
+typedef bool (*prepfn_t)(seginfo_t *pseg, cv::Mat& cap);
+typedef bool (*inferfn_t)(seginfo_t *pseg);
+typedef bool (*maskfn_t)(seginfo_t *pseg, cv::Mat& mask);
+typedef void (*decodefn_t)(const float *tmp, float *out, size_t n);
+
+struct _seginfo_t {
+	tfinfo_t *ptf;
+	hoginfo_t *phg;
+	prepfn_t prepare;
+	inferfn_t infer;
+	maskfn_t mask;
+	decodefn_t decode;
+	std::string chain;	// stage description
+	cv::Mat input;		// wraps input tensor
+	float nscale, noffset;	// input normalisation not folded into the model
+	bool recurrent;		// model carries state between frames
+	seginfo_t *refine;	// cascade: full model run on uncertain regions
+	decodefn_t decodep;	// cascade: foreground probability decoder
+	cv::Mat frame;		// cascade: frame being segmented (shallow)
+	cv::Mat prob;		// cascade: ROI probabilities at the refine scale
+	int64_t refined;	// cascade: frames the full model ran on
+	int64_t skipped;	// cascade: frames too uncertain to refine
+	cv::Mat previn;		// previous resized input, for scene cuts
+	cv::Mat output;		// wraps output tensor
+	cv::Mat hogin;		// resized frame for HOG
+	cv::Rect roidim;	// model aspect ROI in output frame
+	cv::Mat element3;
+	cv::Mat element7;
+	int forced;		// quality flags from environment
+	int flags;		// current quality flags
+	int w, h;
+	int debug;
+};
+
+// find class with maximum probability, set mask to 1.0 where class == person
+static CPU_KERNEL void decode_deeplab(const float *tmp, float *out, size_t n) {
+	for (size_t p = 0; p < n; p++) {
+		float maxval = -10000; int maxpos = 0;
+		for (int i = 0; i < DEEPLAB_CLASSES; i++) {
+			if (tmp[p*DEEPLAB_CLASSES+i] > maxval) {
+				maxval = tmp[p*DEEPLAB_CLASSES+i];
+				maxpos = i;
+			}
+		}
+		out[p] = (maxpos==DEEPLAB_PERSON ? 1.0 : 0);
+	}
+}
+CPU_VARIANTS(void, decode_deeplab, (const float *tmp, float *out, size_t n), (tmp, out, n))
+
+// head pruned at load time (TFINFO_OPT_CLASS): one channel holding
+// logit[person] - max(other logits), so person wins where it is positive
+static CPU_KERNEL void decode_deeplab1(const float *tmp, float *out, size_t n) {
+	for (size_t p = 0; p < n; p++)
+		out[p] = (tmp[p] > 0 ? 1.0 : 0);
+}
+CPU_VARIANTS(void, decode_deeplab1, (const float *tmp, float *out, size_t n), (tmp, out, n))
+
+static CPU_KERNEL void decode_bodypix(const float *tmp, float *out, size_t n) {
+	for (size_t p = 0; p < n; p++) {
+		if (tmp[p] < 0.65) out[p] = 0; else out[p] = 1.0;
+	}
+}
+CPU_VARIANTS(void, decode_bodypix, (const float *tmp, float *out, size_t n), (tmp, out, n))
+
+// Google Meet segmentation network
+	/* 256 x 144 x 2 tensor for the full model or 160 x 96 x 2
+	 * tensor for the light model with masks for background
+	 * (channel 0) and person (channel 1) where values are in
+	 * range [MIN_FLOAT, MAX_FLOAT] and user has to apply
+	 * softmax across both channels to yield foreground
+	 * probability in [0.0, 1.0]. */
+static CPU_KERNEL void decode_segm(const float *tmp, float *out, size_t n) {
+	for (size_t p = 0; p < n; p++) {
+		float exp0 = expf(tmp[2*p  ]);
+		float exp1 = expf(tmp[2*p+1]);
+		float p0 = exp0 / (exp0+exp1);
+		float p1 = exp1 / (exp0+exp1);
+		if (p0 < p1) out[p] = 1.0; else out[p] = 0;
+	}
+}
+CPU_VARIANTS(void, decode_segm, (const float *tmp, float *out, size_t n), (tmp, out, n))
+
+// as above, foreground probability rather than the winning class
+static CPU_KERNEL void decode_segm_prob(const float *tmp, float *out, size_t n) {
+	for (size_t p = 0; p < n; p++)
+		out[p] = 1.0f / (1.0f + expf(tmp[2*p] - tmp[2*p+1]));
+}
+CPU_VARIANTS(void, decode_segm_prob, (const float *tmp, float *out, size_t n), (tmp, out, n))
+
+// recurrent video matting networks (eg. RVM): alpha matte in [0.0, 1.0],
+// used as the mask directly
+static CPU_KERNEL void decode_alpha(const float *tmp, float *out, size_t n) {
+	for (size_t p = 0; p < n; p++)
+		out[p] = std::min(std::max(tmp[p], 0.0f), 1.0f);
+}
+CPU_VARIANTS(void, decode_alpha, (const float *tmp, float *out, size_t n), (tmp, out, n))
+
+static bool prepare_hog(seginfo_t *pseg, cv::Mat& cap) {
+	// Resize to output if required
+	if (cap.cols != pseg->w || cap.rows != pseg->h)
+		cv::resize(cap,pseg->hogin,cv::Size(pseg->w,pseg->h));
+	else
+		pseg->hogin = cap;
+	return true;
+}
+
+static bool infer_hog(seginfo_t *pseg) {
+	return hog_faces(pseg->phg, pseg->hogin, pseg->output);
+}
+
+static bool mask_hog(seginfo_t *pseg, cv::Mat& mask) {
+	// smooth mask..
+	if (pseg->output.empty())
+		return true;
+	if (!(pseg->flags & SEG_NOBLUR))
+		cv::blur(pseg->output,mask,cv::Size(7,7));
+	else
+		pseg->output.copyTo(mask);
+	return true;
+}
+
+static bool prepare_tf(seginfo_t *pseg, cv::Mat& cap) {
+	// map ROI
+	cv::Mat roi = cap(pseg->roidim);
+	// resize ROI to input size, then convert BGR to RGB in place (no
+	// full-size copy of the ROI)
+	cv::Mat in_resized;
+	cv::resize(roi,in_resized,cv::Size(pseg->input.cols,pseg->input.rows));
+	cv::cvtColor(in_resized,in_resized,CV_BGR2RGB);
+
+	// recurrent state describes the old scene after a cut, start afresh
+	if (pseg->recurrent) {
+		if (!pseg->previn.empty()) {
+			cv::Mat diff;
+			cv::absdiff(in_resized,pseg->previn,diff);
+			cv::Scalar d = cv::mean(diff);
+			if ((d[0]+d[1]+d[2])/3 > SCENE_CUT) {
+				tf_reset_state(pseg->ptf);
+				if (pseg->debug) printf("\nscene cut (%.0f), state reset\n", (d[0]+d[1]+d[2])/3);
+			}
+		}
+		in_resized.copyTo(pseg->previn);
+	}
+	if (pseg->debug > 2) cv::imshow("input",in_resized);
+
+	// convert to float and normalize values to [-1;1], unless the model does
+	in_resized.convertTo(pseg->input,CV_32FC3,pseg->nscale,pseg->noffset);
+	return true;
+}
+
+static bool infer_tf(seginfo_t *pseg) {
+	return tf_infer(pseg->ptf);
+}
+
+// denoise, smooth and upscale a small binary mask of the ROI into mask
+static void mask_filter(seginfo_t *pseg, cv::Mat& ofinal, cv::Mat& mask) {
+	if (pseg->debug > 2) cv::imshow("ofinal",ofinal);
+
+	// denoise, close & open with small then large elements, adapted from:
+	// https://stackoverflow.com/questions/42065405/remove-noise-from-threshold-image-opencv-python
+	if (!(pseg->flags & SEG_NODENOISE)) {
+		cv::morphologyEx(ofinal,ofinal,CV_MOP_CLOSE,pseg->element3);
+		cv::morphologyEx(ofinal,ofinal,CV_MOP_OPEN,pseg->element3);
+		if (!(pseg->flags & SEG_NOLARGE)) {
+			cv::morphologyEx(ofinal,ofinal,CV_MOP_CLOSE,pseg->element7);
+			cv::morphologyEx(ofinal,ofinal,CV_MOP_OPEN,pseg->element7);
+			cv::dilate(ofinal,ofinal,pseg->element7);
+		}
+	}
+	// smooth mask edges
+	if (!(pseg->flags & SEG_NOBLUR))
+		cv::blur(ofinal,ofinal,cv::Size(7,7));
+	// scale up into full-sized mask
+	cv::Mat mroi = mask(pseg->roidim);
+	cv::resize(ofinal,mroi,cv::Size(mroi.cols,mroi.rows),0,0,
+		(pseg->flags & SEG_FASTSCALE) ? cv::INTER_NEAREST : cv::INTER_LINEAR);
+}
+
+static bool mask_tf(seginfo_t *pseg, cv::Mat& mask) {
+	// create Mat for small mask
+	cv::Mat ofinal(pseg->output.rows,pseg->output.cols,CV_32FC1);
+	pseg->decode((float*)pseg->output.data, (float*)ofinal.data, pseg->output.total());
+	mask_filter(pseg, ofinal, mask);
+	return true;
+}
+
+// Cascade: the lite model segments the whole ROI, then the pixels it is
+// unsure about (foreground probability within CASCADE_BAND of 0.5) are
+// counted on a coarse grid of tiles. Tiles with more than CASCADE_MIN of
+// their pixels unsure are boxed and that crop, grown to the full model's
+// aspect, is segmented again by the full model at its own resolution; its
+// probabilities replace the uncertain ones. A full model run costs the
+// same whatever the crop, so it is only worth it for a localised crop: if
+// the box would cover more than CASCADE_MAXAREA of the ROI (uncertainty
+// all along the outline) the lite mask is used as is.
+#define CASCADE_BAND	0.3
+#define CASCADE_MIN		0.01
+#define CASCADE_GRID	8	// tiles across and down the ROI
+#define CASCADE_MAXAREA	0.5
+#define CASCADE_MARGIN	8	// pixels at the refine scale
+
+static bool prepare_cascade(seginfo_t *pseg, cv::Mat& cap) {
+	pseg->frame = cap;
+	return prepare_tf(pseg, cap);
+}
+
+static bool mask_cascade(seginfo_t *pseg, cv::Mat& mask) {
+	seginfo_t *pref = pseg->refine;
+	cv::Mat lite(pseg->output.rows,pseg->output.cols,CV_32FC1);
+	pseg->decodep((float*)pseg->output.data, (float*)lite.data, pseg->output.total());
+	cv::resize(lite,pseg->prob,pseg->prob.size());
+	cv::Mat unsure = (pseg->prob > 0.5-CASCADE_BAND) & (pseg->prob < 0.5+CASCADE_BAND);
+	// box around the tiles with a real share of unsure pixels
+	cv::Rect box;
+	for (int ty = 0; ty < CASCADE_GRID; ty++) {
+		for (int tx = 0; tx < CASCADE_GRID; tx++) {
+			cv::Rect tile(tx*unsure.cols/CASCADE_GRID, ty*unsure.rows/CASCADE_GRID,
+				(tx+1)*unsure.cols/CASCADE_GRID - tx*unsure.cols/CASCADE_GRID,
+				(ty+1)*unsure.rows/CASCADE_GRID - ty*unsure.rows/CASCADE_GRID);
+			if (cv::countNonZero(unsure(tile)) > CASCADE_MIN*tile.area())
+				box = box.area() ? (box | tile) : tile;
+		}
+	}
+	if (box.area() > CASCADE_MAXAREA*unsure.total()) {
+		pseg->skipped++;
+	} else if (box.area() > 0) {
+		// uncertain box in frame coordinates, at the full model's aspect
+		box = cv::Rect(box.x-CASCADE_MARGIN, box.y-CASCADE_MARGIN, box.width+2*CASCADE_MARGIN, box.height+2*CASCADE_MARGIN);
+		float sx = (float)pseg->roidim.width/pseg->prob.cols, sy = (float)pseg->roidim.height/pseg->prob.rows;
+		float cx = pseg->roidim.x + (box.x + box.width/2.0f)*sx, cy = pseg->roidim.y + (box.y + box.height/2.0f)*sy;
+		float fw = box.width*sx, fh = box.height*sy, aspect = (float)pref->input.cols/pref->input.rows;
+		if (fw < fh*aspect)
+			fw = fh*aspect;
+		else
+			fh = fw/aspect;
+		cv::Rect crop = cv::Rect((int)(cx-fw/2), (int)(cy-fh/2), (int)fw, (int)fh) & pseg->roidim;
+		// the same area at the refine scale
+		box = cv::Rect((int)((crop.x-pseg->roidim.x)/sx), (int)((crop.y-pseg->roidim.y)/sy),
+			(int)(crop.width/sx), (int)(crop.height/sy)) & cv::Rect(0, 0, pseg->prob.cols, pseg->prob.rows);
+		if (box.width > 0 && box.height > 0) {
+			cv::Mat in_resized;
+			cv::resize(pseg->frame(crop),in_resized,cv::Size(pref->input.cols,pref->input.rows));
+			cv::cvtColor(in_resized,in_resized,CV_BGR2RGB);
+			in_resized.convertTo(pref->input,CV_32FC3,pref->nscale,pref->noffset);
+			if (!tf_infer(pref->ptf))
+				return false;
+			cv::Mat full(pref->output.rows,pref->output.cols,CV_32FC1), fbox;
+			pseg->decodep((float*)pref->output.data, (float*)full.data, pref->output.total());
+			cv::resize(full,fbox,box.size());
+			fbox.copyTo(pseg->prob(box), unsure(box));
+			pseg->refined++;
+		}
+	}
+	cv::Mat ofinal;
+	cv::threshold(pseg->prob,ofinal,0.5,1.0,cv::THRESH_BINARY);
+	mask_filter(pseg, ofinal, mask);
+	return true;
+}
+
+// "cascade[:<lite>+<full>]", both Google Meet models (softmax2 output)
+static seginfo_t *cascade_init(const char *modelname, int w, int h, int threads, int debug) {
+	std::string lite = "models/segm_lite_v681.tflite", full = "models/segm_full_v679.tflite";
+	if (modelname[7]==':') {
+		const char *plus = strchr(modelname+8, '+');
+		ASSERT_OR_NULL(plus != NULL);
+		lite.assign(modelname+8, plus-(modelname+8));
+		full = plus+1;
+	}
+	ASSERT_OR_NULL(strstr(lite.c_str(), "segm_") && strstr(full.c_str(), "segm_"));
+	seginfo_t *pseg = seg_init(lite.c_str(), false, w, h, threads, debug);
+	ASSERT_OR_NULL(pseg != NULL);
+	pseg->refine = seg_init(full.c_str(), false, w, h, threads, debug);
+	ASSERT_OR_NULL(pseg->refine != NULL);
+	pseg->decodep = CPU_SELECT(decode_segm_prob);
+	// probabilities over the lite ROI, at the full model's output scale
+	int pw = pseg->refine->output.cols;
+	pseg->prob = cv::Mat(pw * pseg->roidim.height / pseg->roidim.width, pw, CV_32FC1);
+	pseg->prepare = prepare_cascade;
+	pseg->mask = mask_cascade;
+	char desc[512];
+	snprintf(desc, sizeof(desc), "preprocess(roi %dx%d -> %dx%d) -> infer(tflite %s) -> decode(prob/%s) -> "
+		"refine(%s on p in [%.1f, %.1f], %dx%d) -> filter(morph, blur, upscale)",
+		pseg->roidim.width, pseg->roidim.height, pseg->input.cols, pseg->input.rows, lite.c_str(),
+		cpu_name(cpu_level()), full.c_str(), 0.5-CASCADE_BAND, 0.5+CASCADE_BAND, pseg->prob.cols, pseg->prob.rows);
+	pseg->chain = desc;
+	return pseg;
+}
+
+seginfo_t *seg_init(const char *modelname, bool usehog, int w, int h, int threads, int debug) {
+	if (!usehog && strncmp(modelname, "cascade", 7)==0)
+		return cascade_init(modelname, w, h, threads, debug);
+	seginfo_t *pseg = new seginfo_t;
+	pseg->ptf = NULL;
+	pseg->recurrent = false;
+	pseg->refine = NULL;
+	pseg->refined = 0;
+	pseg->skipped = 0;
+	pseg->phg = NULL;
+	pseg->decode = NULL;
+	pseg->w = w;
+	pseg->h = h;
+	pseg->debug = debug;
+	// environment switches are read once, and always apply
+	pseg->forced = (getenv("DEEPSEG_NODENOISE") ? SEG_NODENOISE : 0) |
+		(getenv("DEEPSEG_NOBLUR") ? SEG_NOBLUR : 0);
+	pseg->flags = pseg->forced;
+
+	// Are we flowing or hogging?
+	if (usehog) {
+		// Load HOG
+		pseg->phg = hog_init(debug);
+		ASSERT_OR_NULL(pseg->phg != NULL);
+		pseg->prepare = prepare_hog;
+		pseg->infer = infer_hog;
+		pseg->mask = mask_hog;
+		pseg->roidim = cv::Rect(0,0,w,h);
+		pseg->chain = "preprocess(resize) -> infer(dlib hog) -> filter(blur)";
+		return pseg;
+	}
+
+	// pick output decoder for this model
+	const char *dname;
+	tfopt_t opt = { TFINFO_OPT_ALL, 1.0/128.0, -1.0, -1 };
+	bool deeplab = strstr(modelname, "deeplab")!=NULL;
+	if (deeplab) {
+		// label number of "person" for DeepLab v3+ model
+		ASSERT_OR_NULL(labels.size()==DEEPLAB_CLASSES && labels[DEEPLAB_PERSON]=="person");
+		pseg->decode = CPU_SELECT(decode_deeplab);
+		dname = "argmax21";
+		opt.flags |= TFINFO_OPT_CLASS;
+		opt.keep = DEEPLAB_PERSON;
+	} else if (strstr(modelname,"body-pix")) {
+		pseg->decode = CPU_SELECT(decode_bodypix);
+		dname = "threshold";
+	} else if (strstr(modelname,"segm_")) {
+		pseg->decode = CPU_SELECT(decode_segm);
+		dname = "softmax2";
+	} else if (strstr(modelname,"rvm") || strstr(modelname,"matting")) {
+		pseg->decode = CPU_SELECT(decode_alpha);
+		dname = "alpha";
+		// RGB in [0.0, 1.0]
+		opt.scale = 1.0/255.0;
+		opt.offset = 0.0;
+	} else {
+		fprintf(stderr, "Error: unknown model type: %s\n", modelname);
+		return NULL;
+	}
+
+	// Load TF model
+	pseg->ptf = tf_init(modelname, threads, debug, &opt);
+	ASSERT_OR_NULL(pseg->ptf != NULL);
+	pseg->recurrent = tf_state_count(pseg->ptf) > 0;
+
+	// wrap input and output tensor with cv::Mat
+	tfbuffer_t *tbuf = tf_get_buffer(pseg->ptf, TFINFO_BUF_IN);
+	ASSERT_OR_NULL(tbuf != NULL);
+	pseg->input = cv::Mat(tbuf->h, tbuf->w, CV_32FC(tbuf->c), tbuf->data);
+	pseg->nscale = tbuf->scale;
+	pseg->noffset = tbuf->offset;
+	delete tbuf;
+	tbuf = tf_get_buffer(pseg->ptf, TFINFO_BUF_OUT);
+	ASSERT_OR_NULL(tbuf != NULL);
+	pseg->output = cv::Mat(tbuf->h, tbuf->w, CV_32FC(tbuf->c), tbuf->data);
+	delete tbuf;
+	if (deeplab && pseg->output.channels()==1) {
+		pseg->decode = CPU_SELECT(decode_deeplab1);
+		dname = "sign";
+	}
+	// https://stackoverflow.com/questions/13384594/fit-a-rectangle-into-another-rectangle
+	float imgRatio = (float)w/(float)h;
+	float modRatio = (float)pseg->output.cols/(float)pseg->output.rows;
+	float resize = (modRatio>imgRatio) ?
+		(float)w/(float)pseg->output.cols :
+		(float)h/(float)pseg->output.rows;
+	float roiWidth = (float)pseg->output.cols * resize;
+	float roiHeight = (float)pseg->output.rows * resize;
+	pseg->roidim = cv::Rect((int)(w-roiWidth)/2,(int)(h-roiHeight)/2,(int)roiWidth,(int)roiHeight);
+	printf("roidim(x,y,w,h)=(%d,%d,%d,%d)\n",pseg->roidim.x,pseg->roidim.y,pseg->roidim.width,pseg->roidim.height);
+
+	// erosion/dilation elements
+	pseg->element3 = cv::getStructuringElement( cv::MORPH_ELLIPSE, cv::Size(3,3) );
+	pseg->element7 = cv::getStructuringElement( cv::MORPH_ELLIPSE, cv::Size(7,7) );
+
+	pseg->prepare = prepare_tf;
+	pseg->infer = infer_tf;
+	pseg->mask = mask_tf;
+	char desc[256];
+	snprintf(desc, sizeof(desc), "preprocess(roi %dx%d -> %dx%d) -> infer(%s%s) -> decode(%s/%s) -> filter(morph, blur, upscale)",
+		pseg->roidim.width, pseg->roidim.height, pseg->input.cols, pseg->input.rows,
+		strncmp(modelname, "aot:", 4)==0 ? "aot" : "tflite", pseg->recurrent ? ", recurrent" : "",
+		dname, cpu_name(cpu_level()));
+	pseg->chain = desc;
+	return pseg;
+}
+
+bool seg_prepare(seginfo_t *pseg, cv::Mat& cap) {
+	return pseg->prepare(pseg, cap);
+}
+
+bool seg_infer(seginfo_t *pseg) {
+	return pseg->infer(pseg);
+}
+
+bool seg_mask(seginfo_t *pseg, cv::Mat& mask) {
+	return pseg->mask(pseg, mask);
+}
+
+const char *seg_chain(seginfo_t *pseg) {
+	return pseg->chain.c_str();
+}
+
+cv::Rect seg_roi(seginfo_t *pseg) {
+	return pseg->roidim;
+}
+
+void seg_set_threads(seginfo_t *pseg, int threads) {
+	if (pseg->ptf)
+		tf_set_threads(pseg->ptf, threads);
+	if (pseg->refine)
+		seg_set_threads(pseg->refine, threads);
+}
+
+void seg_set_quality(seginfo_t *pseg, int flags) {
+	pseg->flags = pseg->forced | flags;
+}
+
+void seg_memory(seginfo_t *pseg, size_t *arena, size_t *weights) {
+	*arena = *weights = 0;
+	if (pseg->ptf)
+		tf_memory(pseg->ptf, arena, weights);
+	if (pseg->refine) {
+		size_t a, w;
+		seg_memory(pseg->refine, &a, &w);
+		*arena += a;
+		*weights += w;
+	}
+}
+
+void seg_stop(seginfo_t *pseg) {
+	if (pseg->refine) {
+		if (pseg->debug)
+			printf("cascade: full model ran on %ld uncertain regions, %ld frames too uncertain to refine\n",
+				(long)pseg->refined, (long)pseg->skipped);
+		seg_stop(pseg->refine);
+	}
+	if (pseg->ptf)
+		tf_stop(pseg->ptf);
+	if (pseg->phg)
+		hog_stop(pseg->phg);
+	delete pseg;
+}
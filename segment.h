@@ -0,0 +1,30 @@
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#include <opencv2/core/mat.hpp>
+
+// opaque type for callers
+struct _seginfo_t;
+typedef struct _seginfo_t seginfo_t;
+
+// mask postprocessing quality flags
+#define SEG_NODENOISE	0x01	// skip all morphology
+#define SEG_NOLARGE		0x02	// skip large-kernel morphology
+#define SEG_NOBLUR		0x04	// skip mask blur
+#define SEG_FASTSCALE	0x08	// nearest neighbour mask upscale
+
+// segmentation pipeline: prepare (ROI, colour convert, resize, normalise),
+// infer (TFLite or HOG), mask (decode, denoise, smooth, upscale into the
+// full-size CV_32FC1 mask supplied by the caller)
+seginfo_t *seg_init(const char *modelname, bool usehog, int w, int h, int threads, int debug);
+bool seg_prepare(seginfo_t *pseg, cv::Mat& cap);
+bool seg_infer(seginfo_t *pseg);
+bool seg_mask(seginfo_t *pseg, cv::Mat& mask);
+const char *seg_chain(seginfo_t *pseg);
+cv::Rect seg_roi(seginfo_t *pseg);	// part of the mask written by seg_mask()
+void seg_set_threads(seginfo_t *pseg, int threads);
+void seg_set_quality(seginfo_t *pseg, int flags);
+void seg_memory(seginfo_t *pseg, size_t *arena, size_t *weights);	// see tf_memory()
+void seg_stop(seginfo_t *pseg);
+
+#endif // _SEGMENT_H_
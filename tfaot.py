@@ -0,0 +1,552 @@
+#!/usr/bin/python3
+# Ahead-of-time compiler for the segmentation models: turns .tflite files
+# into a single C++ translation unit with constexpr tensor shapes, the
+# weights as static data, a static arena plan for activations & scratch and
+# straight-line calls into the TFLite optimized kernels (plus the MediaPipe
+# TransposeConvBias kernel), so inference needs no interpreter, op dispatch
+# or shape propagation. Constant DEQUANTIZE ops are folded and standalone
+# RELU/RELU6 ops are fused into their producer along the way.
+#
+#   ./tfaot.py -o aot_models.cc models/segm_full_v679.tflite ...
+#
+# Link the output with -DDEEPSEG_AOT (make deepseg-aot) and select a model
+# with -m aot:<model>, see aot.h & inference.cc.
+
+from __future__ import print_function
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+# schema.fbs BuiltinOperator codes we know about
+BUILTINS = {
+    0: 'ADD', 1: 'AVERAGE_POOL_2D', 2: 'CONCATENATION', 3: 'CONV_2D',
+    4: 'DEPTHWISE_CONV_2D', 6: 'DEQUANTIZE', 9: 'FULLY_CONNECTED',
+    14: 'LOGISTIC', 17: 'MAX_POOL_2D', 18: 'MUL', 19: 'RELU',
+    20: 'RELU_N1_TO_1', 21: 'RELU6', 22: 'RESHAPE', 23: 'RESIZE_BILINEAR',
+    32: 'CUSTOM', 117: 'HARD_SWISH',
+}
+FLOAT32, FLOAT16, INT32 = 0, 1, 2
+
+# fused activation function -> clamp range
+ACT_NONE, ACT_RELU, ACT_RELU_N1_TO_1, ACT_RELU6 = 0, 1, 2, 3
+ACTIVATIONS = {
+    ACT_NONE: ('std::numeric_limits<float>::lowest()',
+               'std::numeric_limits<float>::max()'),
+    ACT_RELU: ('0.0f', 'std::numeric_limits<float>::max()'),
+    ACT_RELU_N1_TO_1: ('-1.0f', '1.0f'),
+    ACT_RELU6: ('0.0f', '6.0f'),
+}
+STANDALONE_ACT = {'RELU': ACT_RELU, 'RELU_N1_TO_1': ACT_RELU_N1_TO_1,
+                  'RELU6': ACT_RELU6}
+FUSABLE = ('CONV_2D', 'DEPTHWISE_CONV_2D', 'FULLY_CONNECTED', 'ADD', 'MUL',
+           'AVERAGE_POOL_2D', 'MAX_POOL_2D')
+
+ALIGN = 16  # floats, arena & weight offsets are 64 byte aligned
+
+
+class Table(object):
+  """Minimal flatbuffers table reader, enough for the TFLite schema."""
+
+  def __init__(self, buf, pos):
+    self.buf = buf
+    self.pos = pos
+    self.vtab = pos - struct.unpack_from('<i', buf, pos)[0]
+    self.vlen = struct.unpack_from('<H', buf, self.vtab)[0]
+
+  def _field(self, f):
+    o = 4 + 2 * f
+    return struct.unpack_from('<H', self.buf, self.vtab + o)[0] if o < self.vlen else 0
+
+  def scalar(self, f, fmt, default=0):
+    o = self._field(f)
+    return struct.unpack_from('<' + fmt, self.buf, self.pos + o)[0] if o else default
+
+  def _indirect(self, f):
+    o = self._field(f)
+    if not o:
+      return None
+    p = self.pos + o
+    return p + struct.unpack_from('<I', self.buf, p)[0]
+
+  def table(self, f):
+    p = self._indirect(f)
+    return Table(self.buf, p) if p is not None else None
+
+  def vector(self, f):
+    p = self._indirect(f)
+    if p is None:
+      return None, 0
+    return p + 4, struct.unpack_from('<I', self.buf, p)[0]
+
+  def tables(self, f):
+    p, n = self.vector(f)
+    res = []
+    for i in range(n):
+      q = p + 4 * i
+      res.append(Table(self.buf, q + struct.unpack_from('<I', self.buf, q)[0]))
+    return res
+
+  def ints(self, f):
+    p, n = self.vector(f)
+    return list(struct.unpack_from('<%di' % n, self.buf, p)) if p is not None else []
+
+  def bytes(self, f):
+    p, n = self.vector(f)
+    return self.buf[p:p + n] if p is not None else b''
+
+  def string(self, f):
+    p, n = self.vector(f)
+    return self.buf[p:p + n].decode() if p is not None else None
+
+
+class Tensor(object):
+
+  def __init__(self, idx, name, shape, ttype, data):
+    self.idx = idx
+    self.name = name
+    self.shape = shape
+    self.type = ttype
+    self.data = data  # constant contents (list of numbers) or None
+
+  def size(self):
+    n = 1
+    for d in self.shape:
+      n *= d
+    return n
+
+
+class Op(object):
+
+  def __init__(self, kind, inputs, outputs, opts):
+    self.kind = kind
+    self.inputs = inputs
+    self.outputs = outputs
+    self.opts = opts
+
+
+def parse_options(kind, opt, custom):
+  if kind == 'CONV_2D':
+    return {'padding': opt.scalar(0, 'b'), 'stride_w': opt.scalar(1, 'i'),
+            'stride_h': opt.scalar(2, 'i'), 'act': opt.scalar(3, 'b'),
+            'dil_w': opt.scalar(4, 'i', 1), 'dil_h': opt.scalar(5, 'i', 1)}
+  if kind == 'DEPTHWISE_CONV_2D':
+    return {'padding': opt.scalar(0, 'b'), 'stride_w': opt.scalar(1, 'i'),
+            'stride_h': opt.scalar(2, 'i'), 'multiplier': opt.scalar(3, 'i'),
+            'act': opt.scalar(4, 'b'), 'dil_w': opt.scalar(5, 'i', 1),
+            'dil_h': opt.scalar(6, 'i', 1)}
+  if kind in ('AVERAGE_POOL_2D', 'MAX_POOL_2D'):
+    return {'padding': opt.scalar(0, 'b'), 'stride_w': opt.scalar(1, 'i'),
+            'stride_h': opt.scalar(2, 'i'), 'filter_w': opt.scalar(3, 'i'),
+            'filter_h': opt.scalar(4, 'i'), 'act': opt.scalar(5, 'b')}
+  if kind in ('FULLY_CONNECTED', 'ADD', 'MUL'):
+    return {'act': opt.scalar(0, 'b') if opt else ACT_NONE}
+  if kind == 'CONCATENATION':
+    return {'axis': opt.scalar(0, 'i'), 'act': opt.scalar(1, 'b')}
+  if kind == 'RESIZE_BILINEAR':
+    return {'align_corners': bool(opt.scalar(2, 'B') if opt else 0),
+            'half_pixel': bool(opt.scalar(3, 'B') if opt else 0)}
+  if kind == 'Convolution2DTransposeBias':
+    # raw TfLiteTransposeConvParams: padding (1 same, 2 valid), strides
+    padding, stride_w, stride_h = struct.unpack_from('<3i', custom, 0)
+    return {'same': padding == 1, 'stride_w': stride_w, 'stride_h': stride_h}
+  return {}
+
+
+def load(path):
+  buf = open(path, 'rb').read()
+  model = Table(buf, struct.unpack_from('<I', buf, 0)[0])
+  codes = []
+  for oc in model.tables(1):
+    # builtin_code superseded the int8 deprecated_builtin_code in newer schemas
+    code = max(oc.scalar(3, 'i'), oc.scalar(0, 'b'))
+    codes.append(oc.string(1) if code == 32 else BUILTINS.get(code, 'BUILTIN_%d' % code))
+  buffers = model.tables(4)
+  subgraphs = model.tables(2)
+  if len(subgraphs) != 1:
+    raise ValueError('%s: %d subgraphs, expected one' % (path, len(subgraphs)))
+  sg = subgraphs[0]
+
+  tensors = []
+  for idx, t in enumerate(sg.tables(0)):
+    ttype = t.scalar(1, 'b')
+    raw = buffers[t.scalar(2, 'I')].bytes(0)
+    data = None
+    if raw:
+      fmt = {FLOAT32: 'f', FLOAT16: 'e', INT32: 'i'}.get(ttype)
+      if fmt is None:
+        raise ValueError('%s: tensor %d has unsupported type %d' % (path, idx, ttype))
+      data = list(struct.unpack('<%d%s' % (len(raw) // struct.calcsize(fmt), fmt), raw))
+    tensors.append(Tensor(idx, t.string(3), t.ints(0), ttype, data))
+
+  ops = []
+  for o in sg.tables(3):
+    kind = codes[o.scalar(0, 'I')]
+    ops.append(Op(kind, o.ints(1), o.ints(2),
+                  parse_options(kind, o.table(4), o.bytes(5))))
+  return tensors, ops, sg.ints(1), sg.ints(2)
+
+
+class Model(object):
+
+  def __init__(self, path):
+    self.path = path
+    self.sym = re.sub(r'\W', '_', os.path.splitext(os.path.basename(path))[0])
+    self.tensors, self.ops, self.inputs, self.outputs = load(path)
+    self.nops = len(self.ops)
+    self.folded = self.fused = 0
+    self.alias = {}
+
+  def consumers(self, t):
+    return [op for op in self.ops if t in op.inputs]
+
+  def fold_constants(self):
+    # fp16 weights are dequantized once here instead of on every Invoke()
+    keep = []
+    for op in self.ops:
+      src = self.tensors[op.inputs[0]] if op.inputs else None
+      if op.kind in ('DEQUANTIZE', 'RESHAPE') and src.data is not None:
+        dst = self.tensors[op.outputs[0]]
+        dst.data = [float(v) for v in src.data] if op.kind == 'DEQUANTIZE' else src.data
+        dst.type = FLOAT32 if op.kind == 'DEQUANTIZE' else src.type
+        self.folded += 1
+      else:
+        keep.append(op)
+    self.ops = keep
+
+  def fuse_activations(self):
+    keep = []
+    producer = {}
+    for op in self.ops:
+      act = STANDALONE_ACT.get(op.kind)
+      src = op.inputs[0] if op.inputs else -1
+      prev = producer.get(src)
+      if (act is not None and prev is not None and prev.kind in FUSABLE and
+          prev.opts['act'] == ACT_NONE and src not in self.outputs and
+          len(self.consumers(src)) == 1):
+        prev.opts['act'] = act
+        prev.outputs = op.outputs
+        producer[op.outputs[0]] = prev
+        self.fused += 1
+        continue
+      for t in op.outputs:
+        producer[t] = op
+      keep.append(op)
+    self.ops = keep
+
+  def check(self):
+    for op in self.ops:
+      if op.kind not in FUSABLE + ('CONCATENATION', 'RESIZE_BILINEAR', 'LOGISTIC',
+                                   'HARD_SWISH', 'RESHAPE', 'Convolution2DTransposeBias') + \
+                                   tuple(STANDALONE_ACT):
+        raise ValueError('%s: unsupported op %s' % (self.path, op.kind))
+      for t in op.inputs + op.outputs:
+        if t >= 0 and self.tensors[t].type not in (FLOAT32, INT32):
+          raise ValueError('%s: %s on non-float tensor %d' % (self.path, op.kind, t))
+    for t in self.inputs + self.outputs:
+      if len(self.tensors[t].shape) != 4 or self.tensors[t].shape[0] != 1:
+        raise ValueError('%s: tensor %d is not 1xHxWxC' % (self.path, t))
+
+  def root(self, t):
+    while t in self.alias:
+      t = self.alias[t]
+    return t
+
+  def plan(self):
+    """Static arena plan: greedy by size over [first def, last use]
+    lifetimes, as TFLite's arena planner does, plus per-op im2col scratch."""
+    for op in self.ops:
+      if op.kind == 'RESHAPE':
+        self.alias[op.outputs[0]] = op.inputs[0]
+    first, last, size = {}, {}, {}
+
+    def use(key, n, i):
+      first[key] = min(first.get(key, i), i)
+      last[key] = max(last.get(key, i), i)
+      size[key] = max(size.get(key, 0), n)
+
+    end = len(self.ops)
+    for t in self.inputs:
+      use(self.root(t), self.tensors[t].size(), 0)
+    for i, op in enumerate(self.ops):
+      for t in op.inputs + op.outputs:
+        if t >= 0 and self.tensors[t].data is None:
+          use(self.root(t), self.tensors[t].size(), i)
+      if self.im2col(op):
+        use(('im2col', i), self.im2col(op), i)
+    for t in self.outputs:
+      use(self.root(t), self.tensors[t].size(), end)
+
+    self.offset = {}
+    placed = []
+    for key in sorted(size, key=lambda k: (-size[k], first[k])):
+      n = (size[key] + ALIGN - 1) // ALIGN * ALIGN
+      off = 0
+      live = sorted((o, s) for (k, o, s) in placed
+                    if first[k] <= last[key] and first[key] <= last[k])
+      for o, s in live:
+        if off + n <= o:
+          break
+        off = max(off, o + s)
+      self.offset[key] = off
+      placed.append((key, off, n))
+    self.arena = max(o + s for (_, o, s) in placed)
+    self.naive = sum(self.tensors[t].size() for t in size if not isinstance(t, tuple))
+
+  def im2col(self, op):
+    # optimized_ops::Conv() needs an im2col buffer unless it is a plain 1x1
+    if op.kind != 'CONV_2D':
+      return 0
+    o = op.opts
+    fshape = self.tensors[op.inputs[1]].shape
+    if fshape[1] == 1 and fshape[2] == 1 and o['stride_w'] == 1 and o['stride_h'] == 1 and \
+       o['dil_w'] == 1 and o['dil_h'] == 1:
+      return 0
+    oshape = self.tensors[op.outputs[0]].shape
+    return oshape[0] * oshape[1] * oshape[2] * fshape[1] * fshape[2] * fshape[3]
+
+
+def padding(stride, dilation, in_size, filter_size, out_size):
+  # kernels/padding.h ComputePaddingWithOffset()
+  effective = (filter_size - 1) * dilation + 1
+  total = max(0, (out_size - 1) * stride + effective - in_size)
+  return total // 2, total % 2
+
+
+class Emitter(object):
+
+  def __init__(self, model):
+    self.m = model
+    self.lines = []
+    self.weights = []
+    self.woffset = {}
+
+  def w(self, t):
+    # constant tensor -> offset into the model's weight block
+    if t not in self.woffset:
+      data = self.m.tensors[t].data
+      self.woffset[t] = len(self.weights)
+      self.weights.extend(data)
+      self.weights.extend([0] * ((-len(data)) % ALIGN))
+    return 'W + %d' % self.woffset[t]
+
+  def ptr(self, t):
+    if self.m.tensors[t].data is not None:
+      return self.w(t)
+    return 'a + %d' % self.m.offset[self.m.root(t)]
+
+  def shape(self, t):
+    return 'AOT_SHAPE(D%d)' % t
+
+  def act(self, prefix, op):
+    lo, hi = ACTIVATIONS[op.opts.get('act', ACT_NONE)]
+    return ['%s.float_activation_min = %s;' % (prefix, lo),
+            '%s.float_activation_max = %s;' % (prefix, hi)]
+
+  def spatial(self, op, fh, fw, dil_h=1, dil_w=1):
+    o = op.opts
+    ishape = self.m.tensors[op.inputs[0]].shape
+    oshape = self.m.tensors[op.outputs[0]].shape
+    ph, oh = padding(o['stride_h'], dil_h, ishape[1], fh, oshape[1])
+    pw, ow = padding(o['stride_w'], dil_w, ishape[2], fw, oshape[2])
+    return ['p.padding_type = PaddingType::%s;' % ('kSame' if o['padding'] == 0 else 'kValid'),
+            'p.padding_values.height = %d;' % ph, 'p.padding_values.width = %d;' % pw,
+            'p.padding_values.height_offset = %d;' % oh,
+            'p.padding_values.width_offset = %d;' % ow,
+            'p.stride_height = %d;' % o['stride_h'], 'p.stride_width = %d;' % o['stride_w']]
+
+  def op(self, i, op):
+    m = self.m
+    T = m.tensors
+    k = op.kind
+    ins = op.inputs
+    out = op.outputs[0]
+    body = []
+    if k == 'CONV_2D':
+      fshape = T[ins[1]].shape
+      body += ['ConvParams p = ConvParams();']
+      body += self.spatial(op, fshape[1], fshape[2], op.opts['dil_h'], op.opts['dil_w'])
+      body += ['p.dilation_height_factor = %d;' % op.opts['dil_h'],
+               'p.dilation_width_factor = %d;' % op.opts['dil_w']]
+      body += self.act('p', op)
+      n = m.im2col(op)
+      if n:
+        oshape = T[out].shape
+        body += ['const int32_t col[] = { %d, %d, %d, %d };' %
+                 (oshape[0], oshape[1], oshape[2], fshape[1] * fshape[2] * fshape[3])]
+        col = 'AOT_SHAPE(col), a + %d' % m.offset[('im2col', i)]
+      else:
+        col = 'RuntimeShape(), nullptr'
+      body += ['optimized_ops::Conv(p, %s, %s, %s, %s, %s, %s, %s, %s, %s, ctx);' %
+               (self.shape(ins[0]), self.ptr(ins[0]), self.shape(ins[1]), self.ptr(ins[1]),
+                self.shape(ins[2]), self.ptr(ins[2]), self.shape(out), self.ptr(out), col)]
+    elif k == 'DEPTHWISE_CONV_2D':
+      fshape = T[ins[1]].shape
+      body += ['DepthwiseParams p = DepthwiseParams();']
+      body += self.spatial(op, fshape[1], fshape[2], op.opts['dil_h'], op.opts['dil_w'])
+      body += ['p.dilation_height_factor = %d;' % op.opts['dil_h'],
+               'p.dilation_width_factor = %d;' % op.opts['dil_w'],
+               'p.depth_multiplier = %d;' % op.opts['multiplier']]
+      body += self.act('p', op)
+      body += ['optimized_ops::DepthwiseConv<float, float>(p, %s, %s, %s, %s, %s, %s, %s, %s, ctx);' %
+               (self.shape(ins[0]), self.ptr(ins[0]), self.shape(ins[1]), self.ptr(ins[1]),
+                self.shape(ins[2]), self.ptr(ins[2]), self.shape(out), self.ptr(out))]
+    elif k in ('AVERAGE_POOL_2D', 'MAX_POOL_2D'):
+      body += ['PoolParams p = PoolParams();']
+      body += self.spatial(op, op.opts['filter_h'], op.opts['filter_w'])
+      body += ['p.filter_height = %d;' % op.opts['filter_h'],
+               'p.filter_width = %d;' % op.opts['filter_w']]
+      body += self.act('p', op)
+      body += ['optimized_ops::%s(p, %s, %s, %s, %s);' %
+               ('AveragePool' if k == 'AVERAGE_POOL_2D' else 'MaxPool',
+                self.shape(ins[0]), self.ptr(ins[0]), self.shape(out), self.ptr(out))]
+    elif k == 'FULLY_CONNECTED':
+      body += ['FullyConnectedParams p = FullyConnectedParams();']
+      body += self.act('p', op)
+      bias = (self.shape(ins[2]), self.ptr(ins[2])) if len(ins) > 2 and ins[2] >= 0 \
+          else ('RuntimeShape()', 'nullptr')
+      body += ['optimized_ops::FullyConnected(p, %s, %s, %s, %s, %s, %s, %s, %s, ctx);' %
+               ((self.shape(ins[0]), self.ptr(ins[0]), self.shape(ins[1]), self.ptr(ins[1])) +
+                bias + (self.shape(out), self.ptr(out)))]
+    elif k in ('ADD', 'MUL'):
+      s0, s1 = T[ins[0]].shape, T[ins[1]].shape
+      lo, hi = ACTIVATIONS[op.opts['act']]
+      if k == 'MUL' and len(s0) == 4 and s1[:-1] == [1] * (len(s1) - 1) and s1[-1] == s0[3]:
+        # squeeze & excite channel scale: x[1,H,W,C] * s[1,1,1,C]
+        body += ['aot_mul_channels(%s, %s, %s, %d, %d, %s, %s);' %
+                 (self.ptr(ins[0]), self.ptr(ins[1]), self.ptr(out), T[out].size() // s0[3],
+                  s0[3], lo, hi)]
+      else:
+        body += ['ArithmeticParams p = ArithmeticParams();']
+        body += self.act('p', op)
+        fn = 'optimized_ops::%s' % k.capitalize()
+        if s0 != s1:
+          fn = 'reference_ops::Broadcast%s4DSlow' % k.capitalize()
+        body += ['%s(p, %s, %s, %s, %s, %s, %s);' %
+                 (fn, self.shape(ins[0]), self.ptr(ins[0]), self.shape(ins[1]),
+                  self.ptr(ins[1]), self.shape(out), self.ptr(out))]
+    elif k == 'CONCATENATION':
+      axis = op.opts['axis']
+      if axis < 0:
+        axis += len(T[out].shape)
+      body += ['const RuntimeShape %s;' % ', '.join('s%d = %s' % (j, self.shape(t))
+                                                    for j, t in enumerate(ins)),
+               'const RuntimeShape *shapes[] = { %s };' % ', '.join('&s%d' % j for j in range(len(ins))),
+               'const float *data[] = { %s };' % ', '.join(self.ptr(t) for t in ins),
+               'ConcatenationParams p = ConcatenationParams();',
+               'p.axis = %d;' % axis, 'p.inputs_count = %d;' % len(ins),
+               'optimized_ops::Concatenation(p, shapes, data, %s, %s);' %
+               (self.shape(out), self.ptr(out))]
+    elif k == 'RESIZE_BILINEAR':
+      size = T[ins[1]].data
+      body += ['ResizeBilinearParams p = ResizeBilinearParams();',
+               'p.align_corners = %s;' % str(op.opts['align_corners']).lower(),
+               'p.half_pixel_centers = %s;' % str(op.opts['half_pixel']).lower(),
+               'const int32_t dims[] = { 2 }, size[] = { %d, %d };' % (size[0], size[1]),
+               'optimized_ops::ResizeBilinear(p, %s, %s, AOT_SHAPE(dims), size, %s, %s);' %
+               (self.shape(ins[0]), self.ptr(ins[0]), self.shape(out), self.ptr(out))]
+    elif k == 'LOGISTIC':
+      body += ['optimized_ops::Logistic(%s, %s, %s, %s);' %
+               (self.shape(ins[0]), self.ptr(ins[0]), self.shape(out), self.ptr(out))]
+    elif k == 'HARD_SWISH':
+      body += ['aot_hardswish(%s, %s, %d);' % (self.ptr(ins[0]), self.ptr(out), T[out].size())]
+    elif k in STANDALONE_ACT:
+      lo, hi = ACTIVATIONS[STANDALONE_ACT[k]]
+      body += ['aot_clamp(%s, %s, %d, %s, %s);' %
+               (self.ptr(ins[0]), self.ptr(out), T[out].size(), lo, hi)]
+    elif k == 'RESHAPE':
+      return  # output aliases the input in the arena plan
+    elif k == 'Convolution2DTransposeBias':
+      fshape = T[ins[1]].shape
+      ishape = T[ins[0]].shape
+      ph = pw = 0
+      if op.opts['same']:
+        ph = max(0, fshape[1] - (ishape[1] - 1) % op.opts['stride_h'] - 1)
+        pw = max(0, fshape[2] - (ishape[2] - 1) % op.opts['stride_w'] - 1)
+      body += ['ConvParams p = ConvParams();',
+               'p.padding_type = PaddingType::kSame;',
+               'p.padding_values.height = %d;' % (ph // 2),
+               'p.padding_values.width = %d;' % (pw // 2),
+               'p.stride_height = %d;' % op.opts['stride_h'],
+               'p.stride_width = %d;' % op.opts['stride_w'],
+               'mediapipe::tflite_operations::TransposeConvBiasKernel(p, %s, %s, %s, %s, %s, %s, %s, %s);' %
+               (self.shape(ins[0]), self.ptr(ins[0]), self.shape(ins[1]), self.ptr(ins[1]),
+                self.shape(ins[2]), self.ptr(ins[2]), self.shape(out), self.ptr(out))]
+    self.lines.append('\t{\t// %s -> %s' % (k, T[out].name))
+    self.lines += ['\t\t' + l for l in body]
+    self.lines.append('\t}')
+
+  def emit(self):
+    m = self.m
+    for i, op in enumerate(m.ops):
+      self.op(i, op)
+    used = set()
+    for op in m.ops:
+      used.update(t for t in op.inputs + op.outputs if t >= 0)
+    src = ['namespace %s {' % m.sym, '',
+           '// generated from %s: %d ops (%d constant ops folded, %d activations fused)' %
+           (m.path, len(m.ops), m.folded, m.fused), '']
+    for t in sorted(used):
+      src.append('constexpr int32_t D%d[] = { %s };' % (t, ', '.join(str(d) for d in m.tensors[t].shape)))
+    src += ['', '// weights, %d floats' % len(self.weights),
+            'alignas(64) const float W[] = {']
+    for j in range(0, len(self.weights), 8):
+      src.append('\t' + ', '.join('%.9g' % v for v in self.weights[j:j + 8]) + ',')
+    src += ['};', '',
+            '// arena plan: %d floats (%d in separate buffers)' % (m.arena, m.naive),
+            'bool invoke(float *a, tflite::CpuBackendContext *ctx) {',
+            '\tusing namespace tflite;'] + self.lines + ['\treturn true;', '}', '']
+    i, o = m.inputs[0], m.outputs[0]
+    ishape, oshape = m.tensors[i].shape, m.tensors[o].shape
+    src += ['} // namespace %s' % m.sym, '',
+            'const aotmodel_t aot_%s = {' % m.sym,
+            '\t"%s",' % m.path,
+            '\t%d, %d, %d,' % (ishape[2], ishape[1], ishape[3]),
+            '\t%d, %d, %d,' % (oshape[2], oshape[1], oshape[3]),
+            '\t%d, %d, %d,' % (m.arena, m.offset[m.root(i)], m.offset[m.root(o)]),
+            '\t%s::W, sizeof(%s::W),' % (m.sym, m.sym),
+            '\t%d,' % len(m.ops),
+            '\t%s::invoke,' % m.sym,
+            '};', '']
+    return src
+
+
+def main():
+  parser = argparse.ArgumentParser(description='compile TFLite models to C++')
+  parser.add_argument('-o', '--output', default='aot_models.cc', help='output C++ file')
+  parser.add_argument('models', nargs='+', help='.tflite files')
+  args = parser.parse_args()
+
+  out = ['// Generated by tfaot.py from %s, do not edit.' % ' '.join(args.models),
+         '#include <limits>', '',
+         '#include "tensorflow/lite/kernels/internal/optimized/optimized_ops.h"',
+         '#include "tensorflow/lite/kernels/internal/optimized/depthwiseconv_multithread.h"',
+         '#include "tensorflow/lite/kernels/internal/reference/reference_ops.h"', '',
+         '#include "aot.h"', '#include "transpose_conv_bias.h"', '']
+  syms = []
+  for path in args.models:
+    try:
+      m = Model(path)
+      m.fold_constants()
+      m.fuse_activations()
+      m.check()
+      m.plan()
+    except ValueError as e:
+      print('tfaot: %s' % e, file=sys.stderr)
+      return 1
+    src = Emitter(m).emit()
+    print('tfaot: %s: %d -> %d ops, arena %dKB (%dKB unplanned)' %
+          (path, m.nops, len(m.ops), m.arena * 4 // 1024, m.naive * 4 // 1024), file=sys.stderr)
+    out += src
+    syms.append(m.sym)
+  out += ['const aotmodel_t *aot_models[] = {'] + ['\t&aot_%s,' % s for s in syms] + \
+         ['\tNULL,', '};']
+  with open(args.output, 'w') as f:
+    f.write('\n'.join(out) + '\n')
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -17,6 +17,7 @@
 // of the modification is marked below in the code.
 
 #include "transpose_conv_bias.h"
+#include "dispatch.h"
 
 #include "tensorflow/lite/kernels/internal/tensor.h"
 #include "tensorflow/lite/kernels/padding.h"
@@ -34,7 +35,7 @@ constexpr int kOutputTensor = 0;
 // https://github.com/tensorflow/tensorflow/blob/master/tensorflow/lite/kernels/internal/reference/reference_ops.h
 // https://github.com/tensorflow/tensorflow/blob/master/tensorflow/lite/kernels/transpose_conv.cc
 
-inline void TransposeConvBias(
+CPU_KERNEL void TransposeConvBias(
     const ::tflite::ConvParams& params,
     const ::tflite::RuntimeShape& input_shape, const float* input_data,
     const ::tflite::RuntimeShape& filter_shape, const float* filter_data,
@@ -83,25 +84,28 @@ inline void TransposeConvBias(
           // Loop through the output elements it will influence
           const int out_x_origin = (in_x * stride_width) - pad_width;
           const int out_y_origin = (in_y * stride_height) - pad_height;
+          const float input_value = input_data[Offset(
+              input_shape, batch, in_y, in_x, in_channel)];
           for (int filter_y = 0; filter_y < filter_height; ++filter_y) {
             for (int filter_x = 0; filter_x < filter_width; ++filter_x) {
+              // Compute output element location
+              const int out_x = out_x_origin + filter_x;
+              const int out_y = out_y_origin + filter_y;
+              // We cannot accumulate out of bounds
+              if ((out_x < 0) || (out_x >= output_width) || (out_y < 0) ||
+                  (out_y >= output_height))
+                continue;
+              // Bounds checks and offsets hoisted out of the channel loop,
+              // so it compiles to vector code in each dispatch.h variant.
+              float* out_ptr = output_data +
+                  Offset(output_shape, batch, out_y, out_x, 0);
+              const float* filter_ptr = filter_data +
+                  Offset(filter_shape, 0, filter_y, filter_x, in_channel);
+              const int filter_stride = filter_height * filter_width * input_depth;
               for (int out_channel = 0; out_channel < output_depth;
                    ++out_channel) {
-                // Compute output element location
-                const int out_x = out_x_origin + filter_x;
-                const int out_y = out_y_origin + filter_y;
-                // We cannot accumulate out of bounds
-                if ((out_x >= 0) && (out_x < output_width) && (out_y >= 0) &&
-                    (out_y < output_height)) {
-                  float input_value = input_data[Offset(
-                      input_shape, batch, in_y, in_x, in_channel)];
-                  float filter_value =
-                      filter_data[Offset(filter_shape, out_channel, filter_y,
-                                         filter_x, in_channel)];
-                  output_data[Offset(output_shape, batch, out_y, out_x,
-                                     out_channel)] +=
-                      input_value * filter_value;
-                }
+                out_ptr[out_channel] +=
+                    input_value * filter_ptr[out_channel * filter_stride];
               }
             }
           }
@@ -112,6 +116,15 @@ inline void TransposeConvBias(
   // End of MediaPipe modification.
   // End of copy.
 }
+CPU_VARIANTS(void, TransposeConvBias, (
+    const ::tflite::ConvParams& params,
+    const ::tflite::RuntimeShape& input_shape, const float* input_data,
+    const ::tflite::RuntimeShape& filter_shape, const float* filter_data,
+    const ::tflite::RuntimeShape& bias_shape, const float* bias_data,
+    const ::tflite::RuntimeShape& output_shape, float* output_data,
+    const ::tflite::RuntimeShape& im2col_shape, float* im2col_data),
+    (params, input_shape, input_data, filter_shape, filter_data, bias_shape,
+     bias_data, output_shape, output_data, im2col_shape, im2col_data))
 
 // Start of copy from
 // https://github.com/tensorflow/tensorflow/blob/master/tensorflow/lite/kernels/transpose_conv.cc
@@ -227,7 +240,7 @@ TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
       op_params.stride_width = stride_width;
       op_params.stride_height = stride_height;
 
-      TransposeConvBias(
+      CPU_SELECT(TransposeConvBias)(
           op_params, ::tflite::GetTensorShape(input),
           ::tflite::GetTensorData<float>(input),
           ::tflite::GetTensorShape(weights),
@@ -258,6 +271,18 @@ TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
 
 }  // namespace
 
+void TransposeConvBiasKernel(
+    const ::tflite::ConvParams& params,
+    const ::tflite::RuntimeShape& input_shape, const float* input_data,
+    const ::tflite::RuntimeShape& filter_shape, const float* filter_data,
+    const ::tflite::RuntimeShape& bias_shape, const float* bias_data,
+    const ::tflite::RuntimeShape& output_shape, float* output_data) {
+  CPU_SELECT(TransposeConvBias)(params, input_shape, input_data, filter_shape,
+                                filter_data, bias_shape, bias_data,
+                                output_shape, output_data, output_shape,
+                                output_data);
+}
+
 TfLiteRegistration* RegisterConvolution2DTransposeBias() {
   static TfLiteRegistration reg = {nullptr, nullptr, Prepare, Eval};
   return &reg;
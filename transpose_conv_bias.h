@@ -23,6 +23,15 @@ namespace tflite_operations {
 
 TfLiteRegistration* RegisterConvolution2DTransposeBias();
 
+// Direct kernel entry for ahead-of-time compiled models (tfaot.py), with
+// the padding and strides resolved by the caller.
+void TransposeConvBiasKernel(
+    const ::tflite::ConvParams& params,
+    const ::tflite::RuntimeShape& input_shape, const float* input_data,
+    const ::tflite::RuntimeShape& filter_shape, const float* filter_data,
+    const ::tflite::RuntimeShape& bias_shape, const float* bias_data,
+    const ::tflite::RuntimeShape& output_shape, float* output_data);
+
 }  // namespace tflite_operations
 }  // namespace mediapipe
 